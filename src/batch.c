@@ -0,0 +1,355 @@
+#include "batch.h"
+#include "cli.h"
+#include "util.h"
+#include "romdb.h"
+#include "dma.h"
+#include "thread.h"
+#include "mapfile.h"
+#include "verify.h"
+#include "yaz0encdec.h"
+
+#include <stdarg.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+/* One ROM of the batch */
+typedef struct {
+    int             seq;        /* 1-based, in directory order */
+    char           *name;
+    uint64_t        footprint;  /* estimated bytes while in flight */
+    mapped_file_t   rom;
+    dma_table_t     dma;
+    compress_job_t *job;
+    int             next;       /* entries handed out */
+    int             done;       /* entries finished */
+} batch_rom_t;
+
+typedef struct {
+    const char      *in_dir, *out_dir;
+    int              mb;
+    compress_opts_t  opts;
+    int              verbose;   /* one ROM at a time: full progress output */
+    int              verify;    /* check each ROM after writing it */
+    int              verify_threads;
+    batch_rom_t     *roms;
+    int              nroms;
+    int              jobs;
+    uint64_t         max_memory;
+    mutex_t          lock;      /* guards everything below */
+    cond_t           cond;      /* signalled when work or a slot frees up */
+    int              next_rom;  /* first ROM not started yet */
+    batch_rom_t    **active;    /* started ROMs with entries to hand out, oldest first */
+    int              nactive;
+    int              inflight;  /* started and not yet written */
+    uint64_t         mem_used;
+    int              success, skipped;
+} batch_t;
+
+typedef struct {
+    batch_t           *b;
+    compress_worker_t *w;
+} batch_worker_t;
+
+static void ensure_dir(const char *path) {
+#ifdef _WIN32
+    mkdir(path);
+#else
+    mkdir(path, 0755);
+#endif
+}
+
+static int has_z64_ext(const char *name) {
+    size_t len = strlen(name);
+    if (len < 4) return 0;
+    return strcmp(name + len - 4, ".z64") == 0;
+}
+
+/* Progress line for one ROM; prefixed with the ROM when several run at once */
+static void rom_log(const batch_t *b, const batch_rom_t *r, const char *fmt, ...) {
+    char msg[1200];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+    if (b->verbose)
+        fprintf(stderr, "%s", msg);
+    else
+        fprintf(stderr, "[%d] %s: %s", r->seq, r->name, msg);
+}
+
+/* Load, identify and lay out one ROM. Returns 0 if it is skipped. */
+static int start_rom(batch_t *b, batch_rom_t *r) {
+    char in_path[1024];
+    snprintf(in_path, sizeof(in_path), "%s/%s", b->in_dir, r->name);
+
+    if (b->verbose) fprintf(stderr, "\n=== [%d] %s ===\n", r->seq, r->name);
+    rom_log(b, r, "loading '%s'...\n", in_path);
+
+    if (!map_file_read(&r->rom, in_path)) {
+        fprintf(stderr, "error: cannot read '%s', skipping\n", in_path);
+        return 0;
+    }
+    const uint8_t *rom_data = r->rom.data;
+    size_t rom_len = r->rom.size;
+    rom_log(b, r, "ROM size: %zu bytes (%.1f MiB)\n",
+            rom_len, (double)rom_len / (1024 * 1024));
+
+    const rom_version_t *detected = detect_rom_version(rom_data, rom_len);
+    if (!detected) {
+        fprintf(stderr, "warning: could not identify ROM version for '%s', skipping\n",
+                r->name);
+        map_file_close(&r->rom, 0, 0);
+        return 0;
+    }
+    rom_log(b, r, "detected: %s\n", detected->name);
+    rom_log(b, r, "DMA table: 0x%X, %d entries\n",
+            detected->dma_offset, detected->dma_count);
+
+    int err = parse_dma_table(&r->dma, rom_data, rom_len,
+                              detected->dma_offset, detected->dma_count);
+    if (err == YED_OK) err = validate_dma(&r->dma, rom_len);
+    if (err != YED_OK) {
+        fprintf(stderr, "error: '%s': %s, skipping\n", r->name, yed_strerror(err));
+        free_dma_table(&r->dma);
+        map_file_close(&r->rom, 0, 0);
+        return 0;
+    }
+    apply_rom_config(&r->dma, detected);
+
+    int comp_count = 0;
+    for (int i = 0; i < r->dma.num_entries; i++)
+        if (r->dma.entries[i].compress) comp_count++;
+    rom_log(b, r, "files to compress: %d\n", comp_count);
+
+    char out_path[1024];
+    snprintf(out_path, sizeof(out_path), "%s/%s", b->out_dir, r->name);
+    r->job = compress_begin_file(rom_data, b->mb, &r->dma, &b->opts, out_path);
+    if (!r->job) {
+        free_dma_table(&r->dma);
+        map_file_close(&r->rom, 0, 0);
+        return 0;
+    }
+    return 1;
+}
+
+/* Read back a written ROM and check it against its input */
+static int verify_written(const batch_t *b, const batch_rom_t *r) {
+    char out_path[1024];
+    snprintf(out_path, sizeof(out_path), "%s/%s", b->out_dir, r->name);
+
+    mapped_file_t written;
+    if (!map_file_read(&written, out_path)) {
+        fprintf(stderr, "error: cannot open '%s'\n", out_path);
+        return 0;
+    }
+    /* One ROM at a time leaves the pool idle meanwhile; otherwise it
+     * keeps every CPU busy */
+    int threads = b->verbose ? b->verify_threads : 1;
+    int err = verify_rom(written.data, written.size, r->rom.data, r->rom.size,
+                         threads, !b->verbose);
+    map_file_close(&written, 0, 0);
+    if (err != YED_OK)
+        fprintf(stderr, "error: '%s' failed verification: %s\n",
+                out_path, yed_strerror(err));
+    return err == YED_OK;
+}
+
+/* Assemble and write a ROM whose entries have all run. Returns 0 on failure. */
+static int finish_rom(batch_t *b, batch_rom_t *r) {
+    size_t out_rom_size;
+    int ok = compress_end_file(r->job, &out_rom_size);
+    r->job = NULL;
+    free_dma_table(&r->dma);
+
+    if (ok)
+        rom_log(b, r, "compressed ROM written to '%s/%s'\n", b->out_dir, r->name);
+    if (ok && b->verify)
+        ok = verify_written(b, r);
+    map_file_close(&r->rom, 0, 0);
+    return ok;
+}
+
+/* Release a ROM's slot; called with the lock held */
+static void rom_done(batch_t *b, const batch_rom_t *r, int ok) {
+    b->inflight--;
+    b->mem_used -= r->footprint;
+    if (ok) b->success++; else b->skipped++;
+    cond_broadcast(&b->cond);
+}
+
+/* Whether the next ROM may start now; called with the lock held */
+static int can_start(const batch_t *b) {
+    if (b->next_rom >= b->nroms) return 0;
+    if (b->inflight == 0) return 1;
+    if (b->jobs > 0 && b->inflight >= b->jobs) return 0;
+    return !b->max_memory ||
+           b->mem_used + b->roms[b->next_rom].footprint <= b->max_memory;
+}
+
+/*
+ * Pool worker: encode entries of the oldest started ROM, else start the
+ * next ROM if the limits allow, else wait. Whoever finishes the last
+ * entry of a ROM also writes it.
+ */
+static void batch_worker(void *arg) {
+    batch_worker_t *bw = (batch_worker_t *)arg;
+    batch_t *b = bw->b;
+
+    mutex_lock(&b->lock);
+    for (;;) {
+        if (b->nactive > 0) {
+            batch_rom_t *r = b->active[0];
+            int ntasks = compress_job_tasks(r->job);
+            int k = r->next++;
+            if (r->next == ntasks) {
+                b->nactive--;
+                memmove(b->active, b->active + 1, (size_t)b->nactive * sizeof(*b->active));
+            }
+            mutex_unlock(&b->lock);
+            compress_job_run(r->job, k, bw->w);
+            mutex_lock(&b->lock);
+
+            if (++r->done < ntasks) continue;
+            mutex_unlock(&b->lock);
+            int ok = finish_rom(b, r);
+            mutex_lock(&b->lock);
+            rom_done(b, r, ok);
+            continue;
+        }
+
+        if (can_start(b)) {
+            batch_rom_t *r = &b->roms[b->next_rom++];
+            b->inflight++;
+            b->mem_used += r->footprint;
+            mutex_unlock(&b->lock);
+
+            int ok = start_rom(b, r);
+            if (ok && compress_job_tasks(r->job) == 0)
+                ok = finish_rom(b, r) ? 2 : 0;
+            mutex_lock(&b->lock);
+
+            if (ok == 1) {
+                b->active[b->nactive++] = r;
+                cond_broadcast(&b->cond);
+            } else {
+                rom_done(b, r, ok);
+            }
+            continue;
+        }
+
+        if (b->next_rom >= b->nroms && b->inflight == 0) break;
+        cond_wait(&b->cond, &b->lock);
+    }
+    mutex_unlock(&b->lock);
+}
+
+int batch_compress(const char *in_dir, const char *out_dir, int mb,
+                   const compress_opts_t *opts, int jobs, uint64_t max_memory,
+                   int verify, int verify_threads) {
+    if (!in_dir)  die("--batch requires --in <source directory>");
+    if (!out_dir) die("--batch requires --out <target directory>");
+    if (strcmp(in_dir, out_dir) == 0)
+        die("--in and --out cannot be the same directory");
+
+    DIR *dir = opendir(in_dir);
+    if (!dir) {
+        fprintf(stderr, "error: cannot open directory '%s'\n", in_dir);
+        return 1;
+    }
+
+    ensure_dir(out_dir);
+
+    batch_t b;
+    memset(&b, 0, sizeof(b));
+    b.in_dir = in_dir;
+    b.out_dir = out_dir;
+    b.mb = mb;
+    b.jobs = jobs;
+    b.max_memory = max_memory;
+    b.verbose = (jobs == 1);
+    b.verify = verify;
+    b.verify_threads = verify_threads;
+    if (opts) b.opts = *opts;
+    else compress_default_opts(&b.opts);
+    if (!b.verbose) b.opts.quiet = 1;
+
+    /* Collect the ROMs first, so they can be scheduled */
+    int cap = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (!has_z64_ext(ent->d_name))
+            continue;
+        if (b.nroms == cap) {
+            cap = cap ? cap * 2 : 16;
+            b.roms = (batch_rom_t *)realloc(b.roms, (size_t)cap * sizeof(batch_rom_t));
+            if (!b.roms) die("out of memory");
+        }
+        batch_rom_t *r = &b.roms[b.nroms];
+        memset(r, 0, sizeof(*r));
+        r->seq = ++b.nroms;
+        r->name = (char *)malloc(strlen(ent->d_name) + 1);
+        if (!r->name) die("out of memory");
+        strcpy(r->name, ent->d_name);
+
+        /* Input, plus an output image no larger than it (each file
+         * padded to 16 bytes); streams finished ahead of their turn are
+         * held instead of placed, so they fit the same room */
+        char path[1024];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", in_dir, ent->d_name);
+        uint64_t in_size = (stat(path, &st) == 0) ? (uint64_t)st.st_size : 0;
+        uint64_t out_size = in_size + (uint64_t)MAX_DMA_ENTRIES * 16;
+        if ((uint64_t)mb * 0x100000 > out_size)
+            out_size = (uint64_t)mb * 0x100000;
+        r->footprint = in_size + out_size;
+    }
+    closedir(dir);
+
+    b.active = (batch_rom_t **)malloc((size_t)(b.nroms + 1) * sizeof(*b.active));
+    if (!b.active) die("out of memory");
+
+    int nworkers = (b.opts.yaz0.threads > 0) ? b.opts.yaz0.threads : cpu_count();
+    if (!b.verbose)
+        fprintf(stderr, "batch: %d ROMs, %d workers, up to %d at once\n",
+                b.nroms, nworkers, jobs > 0 ? jobs : b.nroms);
+
+    mutex_init(&b.lock);
+    cond_init(&b.cond);
+
+    batch_worker_t *workers = (batch_worker_t *)malloc((size_t)nworkers * sizeof(batch_worker_t));
+    thread_t *tids = (thread_t *)malloc((size_t)nworkers * sizeof(thread_t));
+    if (!workers || !tids) die("out of memory");
+    for (int w = 0; w < nworkers; w++) {
+        workers[w].b = &b;
+        workers[w].w = compress_worker_new(&b.opts);
+        if (!workers[w].w) die("out of memory");
+    }
+
+    /* The calling thread is worker 0 */
+    int started = 1;
+    for (int w = 1; w < nworkers; w++) {
+        if (!thread_start(&tids[w], batch_worker, &workers[w])) break;
+        started++;
+    }
+    batch_worker(&workers[0]);
+    for (int w = 1; w < started; w++)
+        thread_join(tids[w]);
+
+    for (int w = 0; w < nworkers; w++)
+        compress_worker_free(workers[w].w);
+    free(workers);
+    free(tids);
+    cond_destroy(&b.cond);
+    mutex_destroy(&b.lock);
+
+    for (int i = 0; i < b.nroms; i++)
+        free(b.roms[i].name);
+    free(b.roms);
+    free(b.active);
+
+    fprintf(stderr, "\n=== batch complete ===\n");
+    fprintf(stderr, "total: %d, compressed: %d, skipped: %d\n",
+            b.nroms, b.success, b.skipped);
+
+    return (b.success > 0) ? 0 : 1;
+}
\ No newline at end of file
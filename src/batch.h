@@ -0,0 +1,30 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+
+#include "compress.h"
+
+/*
+ * Compress every recognized .z64 ROM in in_dir into out_dir.
+ *
+ * Up to `jobs` ROMs (0 = no limit) are in flight at once, and the DMA
+ * entries of all of them are encoded by one pool of opts->yaz0.threads
+ * workers (0 = one per CPU), oldest ROM first. A ROM is only started if
+ * its estimated footprint (input plus output image) fits in max_memory
+ * bytes next to the ROMs already in flight (0 = no limit); a single ROM
+ * is always allowed, however large.
+ *
+ *   mb     - target output size in MiB, as for compress_rom
+ *   verify - check each written ROM against its input with verify_rom;
+ *            a ROM that fails counts as skipped
+ *   verify_threads - workers for verify_rom while only one ROM is in
+ *            flight (0 = one per CPU); otherwise each check runs on one
+ *
+ * Returns 0 if at least one ROM was compressed, 1 otherwise.
+ */
+int batch_compress(const char *in_dir, const char *out_dir, int mb,
+                   const compress_opts_t *opts, int jobs, uint64_t max_memory,
+                   int verify, int verify_threads);
+
+#endif /* BATCH_H */
\ No newline at end of file
@@ -0,0 +1,286 @@
+/*
+ * yaz0bench - throughput of the Yaz0 encoder, decoder, CRC-32 and N64
+ * checksum.
+ *
+ * Every kernel runs on generated corpora shaped like ROM contents, so no
+ * ROM is needed and runs on different machines see the same input. Each
+ * measurement is repeated; the minimum and median times are reported on
+ * stdout and, with --json, written one result per line so two runs can
+ * be diffed.
+ */
+#include "cli.h"
+#include "util.h"
+#include "yaz0.h"
+#include "n64crc.h"
+#include "crc32.h"
+#include "corpus.h"
+
+#define CORPUS_SIZE_DEFAULT  (1024 * 1024)
+#define REPS_DEFAULT         5
+#define MAX_REPS             101
+
+/* Boot code CRCs n64crc recognizes, and the header offsets it checksums */
+#define BOOT_START       0x40
+#define BOOT_END         0x1000
+#define BOOT_CRC_6102    0x90BB6CB5u
+#define BOOT_CRC_6105    0x98BC2C86u
+#define CHECKSUM_BYTES   0x100000
+
+/* --- Checksum input --- */
+
+/* Byte table, for running the CRC backwards */
+static uint32_t crc_table[256];
+
+static void crc_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? (c >> 1) ^ 0xEDB88320u : c >> 1;
+        crc_table[i] = c;
+    }
+}
+
+/*
+ * Fill the boot code with random bytes, then choose its last four so its
+ * CRC32 is the one n64crc expects for the wanted CIC.
+ */
+static void forge_boot_code(uint8_t *rom, uint32_t want) {
+    for (int i = BOOT_START; i < BOOT_END - 4; i++)
+        rom[i] = (uint8_t)corpus_rng();
+
+    uint32_t reg = crc32_calc(rom + BOOT_START, BOOT_END - 4 - BOOT_START) ^ 0xFFFFFFFFu;
+
+    /* Run the register back from the wanted value over four bytes */
+    uint32_t back = want ^ 0xFFFFFFFFu;
+    for (int k = 0; k < 4; k++) {
+        int idx = 0;
+        while ((crc_table[idx] >> 24) != (back >> 24)) idx++;
+        back = ((back ^ crc_table[idx]) << 8) | (uint32_t)idx;
+    }
+    for (int k = 0; k < 4; k++)
+        rom[BOOT_END - 4 + k] = (uint8_t)((reg ^ back) >> (8 * k));
+}
+
+/* --- Timing --- */
+
+typedef struct {
+    const char *kernel;
+    const char *corpus;
+    int         level;     /* encoder level, 0 = not an encode */
+    size_t      bytes;     /* input processed per repetition */
+    size_t      out_bytes; /* encoder output, 0 = not an encode */
+    uint64_t    min_ns, median_ns;
+} result_t;
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void finish(result_t *r, uint64_t *times, int reps) {
+    qsort(times, (size_t)reps, sizeof(uint64_t), cmp_u64);
+    r->min_ns = times[0] ? times[0] : 1;
+    r->median_ns = times[reps / 2] ? times[reps / 2] : 1;
+}
+
+static double mb_s(const result_t *r, uint64_t ns) {
+    return (double)r->bytes / (1024.0 * 1024.0) / ((double)ns / 1e9);
+}
+
+static void print_result(const result_t *r) {
+    char what[64];
+    if (r->level)
+        snprintf(what, sizeof(what), "%s L%d", r->kernel, r->level);
+    else
+        snprintf(what, sizeof(what), "%s", r->kernel);
+    printf("%-10s %-9s %9.1f %9.1f %8.2f %8.2f",
+           what, r->corpus, mb_s(r, r->min_ns), mb_s(r, r->median_ns),
+           (double)r->min_ns / (double)r->bytes,
+           (double)r->median_ns / (double)r->bytes);
+    if (r->out_bytes)
+        printf(" %7.2f%%", (double)r->out_bytes / (double)r->bytes * 100.0);
+    printf("\n");
+    fflush(stdout);
+}
+
+static void write_json(FILE *f, const result_t *res, int nres, size_t corpus_size, int reps) {
+    fprintf(f, "{\n");
+    fprintf(f, "  \"encoder_version\": %d,\n", YAZ0_ENCODER_VERSION);
+    fprintf(f, "  \"corpus_size\": %zu,\n", corpus_size);
+    fprintf(f, "  \"reps\": %d,\n", reps);
+    fprintf(f, "  \"results\": [\n");
+    for (int i = 0; i < nres; i++) {
+        const result_t *r = &res[i];
+        fprintf(f, "    {\"kernel\": \"%s\", \"corpus\": \"%s\", \"level\": %d, "
+                "\"bytes\": %zu, \"out_bytes\": %zu, \"min_ns\": %llu, \"median_ns\": %llu, "
+                "\"mb_s_min\": %.1f, \"mb_s_median\": %.1f, "
+                "\"ns_per_byte_min\": %.3f, \"ns_per_byte_median\": %.3f}%s\n",
+                r->kernel, r->corpus, r->level, r->bytes, r->out_bytes,
+                (unsigned long long)r->min_ns, (unsigned long long)r->median_ns,
+                mb_s(r, r->min_ns), mb_s(r, r->median_ns),
+                (double)r->min_ns / (double)r->bytes,
+                (double)r->median_ns / (double)r->bytes,
+                (i + 1 < nres) ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+static void usage(void) {
+    fprintf(stderr,
+        "yaz0bench - Yaz0 codec, CRC-32 and N64 checksum benchmarks\n"
+        "\n"
+        "Usage:\n"
+        "    yaz0bench [--reps <n>] [--size <KiB>] [--json <file>]\n"
+        "\n"
+        "Options:\n"
+        "    --reps <n>      Repetitions per measurement (default 5)\n"
+        "    --size <KiB>    Size of each corpus (default 1024)\n"
+        "    --json <file>   Also write the results as JSON\n"
+        "\n"
+    );
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    int reps = REPS_DEFAULT;
+    size_t size = CORPUS_SIZE_DEFAULT;
+    const char *json_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strcmp(arg, "--reps") == 0) {
+            if (++i >= argc) die("--reps requires a value");
+            reps = atoi(argv[i]);
+            if (reps < 1 || reps > MAX_REPS) die("--reps must be between 1 and 101");
+        } else if (strcmp(arg, "--size") == 0) {
+            if (++i >= argc) die("--size requires a value");
+            int kib = atoi(argv[i]);
+            if (kib <= 0) die("--size must be a positive size in KiB");
+            size = (size_t)kib * 1024;
+        } else if (strcmp(arg, "--json") == 0) {
+            if (++i >= argc) die("--json requires a value");
+            json_path = argv[i];
+        } else {
+            usage();
+        }
+    }
+
+    int max_results = (int)num_corpora * 5 + 2;
+    result_t *res = (result_t *)calloc((size_t)max_results, sizeof(result_t));
+    uint8_t *data = (uint8_t *)malloc(size);
+    uint8_t *dec = (uint8_t *)malloc(size);
+    uint8_t *enc = (uint8_t *)malloc(yaz0_compress_bound(size));
+    uint8_t *rom = (uint8_t *)calloc(N64CRC_SPAN, 1);
+    if (!res || !data || !dec || !enc || !rom) die("out of memory");
+    uint64_t times[MAX_REPS];
+    int nres = 0;
+
+    printf("%-10s %-9s %9s %9s %8s %8s %8s\n",
+           "kernel", "corpus", "MB/s min", "MB/s med", "ns/B min", "ns/B med", "ratio");
+
+    for (size_t c = 0; c < num_corpora; c++) {
+        corpus_seed(0x9E3779B97F4A7C15ull + c);
+        corpora[c].gen(data, size);
+
+        /* Encode at every level */
+        for (int level = YAZ0_LEVEL_GREEDY; level <= YAZ0_LEVEL_OPTIMAL; level++) {
+            yaz0_params_t params;
+            yaz0_default_params(&params);
+            params.level = level;
+            yaz0_encoder_t *e = yaz0_encoder_new(&params);
+            if (!e) die("out of memory");
+
+            result_t *r = &res[nres++];
+            r->kernel = "encode";
+            r->corpus = corpora[c].name;
+            r->level = level;
+            r->bytes = size;
+            for (int k = 0; k < reps; k++) {
+                uint64_t t0 = time_ns();
+                r->out_bytes = yaz0_encoder_encode_into(e, data, size, enc,
+                                                        yaz0_compress_bound(size));
+                times[k] = time_ns() - t0;
+                if (r->out_bytes == 0) die("out of memory");
+            }
+            yaz0_encoder_free(e);
+            finish(r, times, reps);
+            print_result(r);
+        }
+
+        /* Decode a lazy stream, the kind ordinary ROMs hold */
+        size_t lazy_size = yaz0_encode_into(data, size, enc, yaz0_compress_bound(size), NULL);
+        result_t *r = &res[nres++];
+        r->kernel = "decode";
+        r->corpus = corpora[c].name;
+        r->bytes = size;
+        for (int k = 0; k < reps; k++) {
+            size_t n;
+            uint64_t t0 = time_ns();
+            int err = yaz0_decode_checked(enc, lazy_size, dec, size, &n);
+            times[k] = time_ns() - t0;
+            if (err != YAZ0_OK || n != size || memcmp(dec, data, size) != 0)
+                die("decoded data does not match the input");
+        }
+        finish(r, times, reps);
+        print_result(r);
+
+        /* CRC-32, as --stats runs it over every file */
+        r = &res[nres++];
+        r->kernel = "crc32";
+        r->corpus = corpora[c].name;
+        r->bytes = size;
+        uint32_t first = 0;
+        for (int k = 0; k < reps; k++) {
+            uint64_t t0 = time_ns();
+            uint32_t crc = crc32_calc(data, size);
+            times[k] = time_ns() - t0;
+            if (k > 0 && crc != first) die("CRC-32 is not deterministic");
+            first = crc;
+        }
+        finish(r, times, reps);
+        print_result(r);
+    }
+
+    /* Checksum over the mixed corpus, for the common and the 6105 boot code */
+    crc_init();
+    static const struct { const char *name; uint32_t crc; } cics[] = {
+        { "cic6102", BOOT_CRC_6102 },
+        { "cic6105", BOOT_CRC_6105 },
+    };
+    for (size_t c = 0; c < sizeof(cics) / sizeof(cics[0]); c++) {
+        corpus_seed(0x2545F4914F6CDD1Dull + c);
+        corpus_mixed(rom, N64CRC_SPAN);
+        forge_boot_code(rom, cics[c].crc);
+
+        result_t *r = &res[nres++];
+        r->kernel = "n64crc";
+        r->corpus = cics[c].name;
+        r->bytes = CHECKSUM_BYTES;
+        for (int k = 0; k < reps; k++) {
+            uint64_t t0 = time_ns();
+            int ok = n64crc(rom);
+            times[k] = time_ns() - t0;
+            if (!ok) die("checksum input has an unknown boot code");
+        }
+        finish(r, times, reps);
+        print_result(r);
+    }
+
+    if (json_path) {
+        FILE *f = fopen(json_path, "w");
+        if (!f) {
+            fprintf(stderr, "error: cannot write '%s'\n", json_path);
+            exit(1);
+        }
+        write_json(f, res, nres, size, reps);
+        fclose(f);
+        printf("results written to '%s'\n", json_path);
+    }
+
+    free(res);
+    free(data);
+    free(dec);
+    free(enc);
+    free(rom);
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,213 @@
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE  /* getpid, utime */
+#endif
+
+#include "cache.h"
+#include "mapfile.h"
+#include "thread.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <utime.h>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+#define CACHE_EXT  ".yaz0"
+
+struct cache {
+    char    *dir;
+    uint64_t max_bytes;
+    mutex_t  lock;      /* guards the counters below */
+    int      hits, misses, stores;
+    unsigned tmp_seq;   /* makes temporary names unique within the process */
+};
+
+cache_t *cache_open(const char *dir, uint64_t max_bytes) {
+#ifdef _WIN32
+    mkdir(dir);
+#else
+    mkdir(dir, 0755);
+#endif
+    struct stat st;
+    if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode))
+        return NULL;
+
+    cache_t *c = (cache_t *)calloc(1, sizeof(*c));
+    if (!c) return NULL;
+    c->dir = (char *)malloc(strlen(dir) + 1);
+    if (!c->dir) {
+        free(c);
+        return NULL;
+    }
+    strcpy(c->dir, dir);
+    c->max_bytes = max_bytes;
+    mutex_init(&c->lock);
+    return c;
+}
+
+/* Path of the blob for one input */
+static void blob_path(const cache_t *c, char *path, size_t cap,
+                      const uint8_t *data, size_t size,
+                      const yaz0_params_t *params) {
+    snprintf(path, cap, "%s/%016llx-%08lx-v%dl%de%ds%lx" CACHE_EXT, c->dir,
+             (unsigned long long)hash64(data, size), (unsigned long)size,
+             YAZ0_ENCODER_VERSION, params->level, params->engine,
+             (unsigned long)params->split_size);
+}
+
+int cache_get(cache_t *c, const uint8_t *data, size_t size,
+              const yaz0_params_t *params, buf_t *out) {
+    char path[1024];
+    blob_path(c, path, sizeof(path), data, size, params);
+
+    int hit = 0;
+    FILE *f = fopen(path, "rb");
+    if (f) {
+        fseek(f, 0, SEEK_END);
+        long len = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        /* Out of memory is just a miss; the file gets encoded instead */
+        out->len = 0;
+        if (len > 0 && buf_try_reserve(out, (size_t)len)) {
+            if (fread(out->data, 1, (size_t)len, f) == (size_t)len) {
+                out->len = (size_t)len;
+                hit = yaz0_decodes_to(out->data, out->len, data, size) != 0;
+            }
+        }
+        fclose(f);
+    }
+
+    /* Mark as recently used */
+    if (hit) utime(path, NULL);
+
+    mutex_lock(&c->lock);
+    if (hit) c->hits++; else c->misses++;
+    mutex_unlock(&c->lock);
+    return hit;
+}
+
+void cache_put(cache_t *c, const uint8_t *data, size_t size,
+               const yaz0_params_t *params,
+               const uint8_t *blob, size_t blob_size) {
+    char path[1024], tmp[1100];
+    blob_path(c, path, sizeof(path), data, size, params);
+
+    mutex_lock(&c->lock);
+    unsigned seq = c->tmp_seq++;
+    mutex_unlock(&c->lock);
+    snprintf(tmp, sizeof(tmp), "%s.tmp%ld-%u", path, (long)getpid(), seq);
+
+    FILE *f = fopen(tmp, "wb");
+    if (!f) return;
+    size_t written = fwrite(blob, 1, blob_size, f);
+    if (fclose(f) != 0 || written != blob_size) {
+        remove(tmp);
+        return;
+    }
+
+    /* Publish atomically; a concurrent writer of the same key wrote the
+     * same bytes, so either file may win */
+    if (!rename_over(tmp, path)) {
+        remove(tmp);
+        return;
+    }
+
+    mutex_lock(&c->lock);
+    c->stores++;
+    mutex_unlock(&c->lock);
+}
+
+/* --- Eviction --- */
+
+typedef struct {
+    char    *name;
+    uint64_t size;
+    time_t   mtime;
+} cache_file_t;
+
+static int cmp_by_mtime(const void *a, const void *b) {
+    const cache_file_t *fa = (const cache_file_t *)a;
+    const cache_file_t *fb = (const cache_file_t *)b;
+    if (fa->mtime < fb->mtime) return -1;
+    if (fa->mtime > fb->mtime) return 1;
+    return strcmp(fa->name, fb->name);
+}
+
+static int has_ext(const char *name, const char *ext) {
+    size_t len = strlen(name), elen = strlen(ext);
+    return len > elen && strcmp(name + len - elen, ext) == 0;
+}
+
+/* Delete the least recently used blobs until the rest fit; returns the
+ * count. Out of memory skips eviction until the next run. */
+static int cache_evict(cache_t *c) {
+    DIR *dir = opendir(c->dir);
+    if (!dir) return 0;
+
+    cache_file_t *files = NULL;
+    int nfiles = 0, cap = 0;
+    uint64_t total = 0;
+    char path[1024];
+
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (!has_ext(ent->d_name, CACHE_EXT)) continue;
+        snprintf(path, sizeof(path), "%s/%s", c->dir, ent->d_name);
+        struct stat st;
+        if (stat(path, &st) != 0) continue;
+
+        if (nfiles == cap) {
+            int new_cap = cap ? cap * 2 : 256;
+            cache_file_t *grown = (cache_file_t *)realloc(
+                files, (size_t)new_cap * sizeof(cache_file_t));
+            if (!grown) break;
+            files = grown;
+            cap = new_cap;
+        }
+        cache_file_t *cf = &files[nfiles];
+        cf->name = (char *)malloc(strlen(ent->d_name) + 1);
+        if (!cf->name) break;
+        nfiles++;
+        strcpy(cf->name, ent->d_name);
+        cf->size = (uint64_t)st.st_size;
+        cf->mtime = st.st_mtime;
+        total += cf->size;
+    }
+    int complete = (ent == NULL);
+    closedir(dir);
+
+    int evicted = 0;
+    if (complete && total > c->max_bytes) {
+        qsort(files, (size_t)nfiles, sizeof(cache_file_t), cmp_by_mtime);
+        for (int i = 0; i < nfiles && total > c->max_bytes; i++) {
+            snprintf(path, sizeof(path), "%s/%s", c->dir, files[i].name);
+            /* Another run may have evicted it already */
+            if (remove(path) == 0) evicted++;
+            total -= files[i].size;
+        }
+    }
+
+    for (int i = 0; i < nfiles; i++)
+        free(files[i].name);
+    free(files);
+    return evicted;
+}
+
+void cache_close(cache_t *c, cache_stats_t *stats) {
+    if (!c) return;
+    int evicted = cache_evict(c);
+    if (stats) {
+        stats->hits = c->hits;
+        stats->misses = c->misses;
+        stats->stores = c->stores;
+        stats->evicted = evicted;
+    }
+    mutex_destroy(&c->lock);
+    free(c->dir);
+    free(c);
+}
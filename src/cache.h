@@ -0,0 +1,51 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "util.h"
+#include "yaz0.h"
+
+/*
+ * Persistent Yaz0 blob cache. Each finished blob is stored in its own
+ * file, named after a hash of the uncompressed bytes, their size, the
+ * encoder version and the encoder settings, so unchanged files are a
+ * lookup on the next run.
+ *
+ * Files are written under a temporary name and renamed into place, so
+ * readers never see a partial blob and concurrent runs may share one
+ * directory. Hits refresh the file's modification time; cache_close
+ * evicts the least recently used files until the directory fits its
+ * size limit. A hit is only returned after the blob has been decoded
+ * and compared with the input, so hash collisions or damaged files cost
+ * an encode, never a wrong ROM.
+ */
+typedef struct cache cache_t;
+
+/* Open (creating if needed) a cache directory holding up to max_bytes.
+ * Returns NULL if dir is not a usable directory or out of memory. */
+cache_t *cache_open(const char *dir, uint64_t max_bytes);
+
+/* What a cache did during one run */
+typedef struct {
+    int hits, misses, stores, evicted;
+} cache_stats_t;
+
+/* Evict down to the size limit, store the run's statistics in *stats
+ * (if not NULL) and free the cache */
+void cache_close(cache_t *c, cache_stats_t *stats);
+
+/*
+ * Look up the blob for data[0..size) encoded with params. On a hit the
+ * blob is stored in *out and 1 is returned. Thread-safe.
+ */
+int cache_get(cache_t *c, const uint8_t *data, size_t size,
+              const yaz0_params_t *params, buf_t *out);
+
+/* Store the blob for data[0..size). Thread-safe; failures are ignored. */
+void cache_put(cache_t *c, const uint8_t *data, size_t size,
+               const yaz0_params_t *params,
+               const uint8_t *blob, size_t blob_size);
+
+#endif /* CACHE_H */
@@ -0,0 +1,9 @@
+#include "cli.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+void die(const char *msg) {
+    fprintf(stderr, "error: %s\n", msg);
+    exit(1);
+}
\ No newline at end of file
@@ -0,0 +1,12 @@
+#ifndef CLI_H
+#define CLI_H
+
+/*
+ * Helpers for the command-line tools (yaz0encdec, yaz0bench and the
+ * tests). Not part of libyaz0encdec, which never exits the process.
+ */
+
+/* Fatal error - prints message and exits */
+void die(const char *msg);
+
+#endif /* CLI_H */
\ No newline at end of file
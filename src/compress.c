@@ -3,18 +3,286 @@
 #include "dma.h"
 #include "yaz0.h"
 #include "n64crc.h"
+#include "thread.h"
+#include "mapfile.h"
+#include "yaz0encdec.h"
 
-/* Sort comparator: by original start offset */
+void compress_default_opts(compress_opts_t *opts) {
+    yaz0_default_params(&opts->yaz0);
+    opts->cache = NULL;
+    opts->reuse = NULL;
+    opts->share_dups = 0;
+    opts->quiet = 0;
+    opts->stats = 0;
+}
+
+/* Sort comparator: by original start offset, ties in DMA order */
 static int cmp_by_ostart(const void *a, const void *b) {
-    int ia = *(const int *)a, ib = *(const int *)b;
-    if (entries[ia].ostart < entries[ib].ostart) return -1;
-    if (entries[ia].ostart > entries[ib].ostart) return 1;
-    return 0;
+    const dma_entry_t *ea = *(const dma_entry_t *const *)a;
+    const dma_entry_t *eb = *(const dma_entry_t *const *)b;
+    if (ea->ostart < eb->ostart) return -1;
+    if (ea->ostart > eb->ostart) return 1;
+    return ea->index - eb->index;
+}
+
+/* Sort comparator: largest file first, ties in DMA order */
+static int cmp_by_size_desc(const void *a, const void *b) {
+    const dma_entry_t *ea = *(const dma_entry_t *const *)a;
+    const dma_entry_t *eb = *(const dma_entry_t *const *)b;
+    uint32_t sa = ea->end - ea->start;
+    uint32_t sb = eb->end - eb->start;
+    if (sa != sb) return (sa > sb) ? -1 : 1;
+    return ea->index - eb->index;
+}
+
+/* Entry contents, for finding duplicates */
+typedef struct {
+    uint64_t hash;
+    uint32_t size;
+    int      index;
+} content_key_t;
+
+static int cmp_content(const void *a, const void *b) {
+    const content_key_t *x = (const content_key_t *)a, *y = (const content_key_t *)b;
+    if (x->hash != y->hash) return (x->hash < y->hash) ? -1 : 1;
+    if (x->size != y->size) return (x->size < y->size) ? -1 : 1;
+    return x->index - y->index;
+}
+
+/*
+ * Set dup_of on every listed entry whose contents and compress flag match
+ * an earlier one, so each distinct payload is compressed once. Returns
+ * the number of duplicates, or -1 if out of memory.
+ */
+static int find_duplicates(dma_table_t *dma, const uint8_t *rom_data,
+                           dma_entry_t *const *list, int n) {
+    dma_entry_t *entries = dma->entries;
+    content_key_t *keys = (content_key_t *)malloc((size_t)(n + 1) * sizeof(content_key_t));
+    if (!keys) return -1;
+    for (int k = 0; k < n; k++) {
+        const dma_entry_t *e = list[k];
+        keys[k].size = e->end - e->start;
+        keys[k].hash = hash64(rom_data + e->start, keys[k].size);
+        keys[k].index = e->index;
+    }
+    qsort(keys, (size_t)n, sizeof(content_key_t), cmp_content);
+
+    /* Within a run of equal keys, entries are in DMA order */
+    int dups = 0;
+    for (int k = 0; k < n; k++) {
+        dma_entry_t *e = &entries[keys[k].index];
+        for (int j = k - 1; j >= 0 && keys[j].hash == keys[k].hash &&
+                            keys[j].size == keys[k].size; j--) {
+            dma_entry_t *p = &entries[keys[j].index];
+            if (p->dup_of < 0 && p->compress == e->compress &&
+                memcmp(rom_data + p->start, rom_data + e->start, keys[k].size) == 0) {
+                e->dup_of = keys[j].index;
+            }
+        }
+        if (e->dup_of >= 0) dups++;
+    }
+    free(keys);
+    return dups;
 }
 
-uint8_t *compress_rom(const uint8_t *rom_data, int mb,
-                      uint32_t dma_offset, int dma_count,
-                      size_t *out_size) {
+/* Per-entry state while a job's blobs wait for their place in the image */
+typedef struct {
+    uint8_t *held;    /* copy of a stream finished ahead of its turn */
+    int      ready;   /* encoded, or stored as is */
+} job_slot_t;
+
+struct compress_job {
+    const uint8_t   *rom_data;
+    int              mb;
+    dma_table_t     *dma;
+    compress_opts_t  opts;
+    uint8_t         *out_rom;
+    size_t           out_cap;
+    char            *out_path;    /* output file, NULL = in memory */
+    mapped_file_t    out;
+    dma_entry_t    **order;   /* entries to compress, largest first */
+    dma_entry_t    **files;   /* entries with data, in ROM order */
+    int              nfiles;
+    job_slot_t      *slots;   /* by entry index */
+    int              ntasks;
+    mutex_t          lock;    /* guards everything below and the progress line */
+    int              done;
+    int              wpos;    /* next file to place */
+    size_t           comp_total, total_compressed;
+    int              err;     /* YED_ERR_* of the first failed entry */
+};
+
+struct compress_worker {
+    yaz0_params_t   params;   /* opts->yaz0, one thread per encoder */
+    yaz0_encoder_t *enc;
+    buf_t           blob;     /* for cache reads */
+    buf_t           stream;   /* the entry being encoded */
+};
+
+compress_worker_t *compress_worker_new(const compress_opts_t *opts) {
+    compress_worker_t *w = (compress_worker_t *)calloc(1, sizeof(*w));
+    if (!w) return NULL;
+    if (opts) w->params = opts->yaz0;
+    else yaz0_default_params(&w->params);
+    w->params.threads = 1;
+    w->enc = yaz0_encoder_new(&w->params);
+    if (!w->enc) {
+        free(w);
+        return NULL;
+    }
+    /* w->blob and w->stream grow with the first entry that needs them */
+    return w;
+}
+
+void compress_worker_free(compress_worker_t *w) {
+    if (!w) return;
+    yaz0_encoder_free(w->enc);
+    buf_free(&w->blob);
+    buf_free(&w->stream);
+    free(w);
+}
+
+int compress_job_tasks(const compress_job_t *job) {
+    return job->ntasks;
+}
+
+/*
+ * Produce the Yaz0 stream of entry e's data in slot (room for its
+ * compress bound) and return its length. A length of at least size means
+ * Yaz0 does not pay off; slot is then left undefined unless the stream
+ * was encoded here. Returns 0 if out of memory.
+ */
+static size_t encode_file(const compress_opts_t *opts, compress_worker_t *w,
+                          dma_entry_t *e, const uint8_t *data, size_t size,
+                          uint8_t *slot) {
+    uint64_t t0 = opts->stats ? time_ns() : 0;
+    size_t comp_sz;
+    const uint8_t *blob;
+
+    if (opts->reuse && reuse_get(opts->reuse, data, size, &blob, &comp_sz)) {
+        /* Taken verbatim from the old ROM */
+        if (comp_sz < size) memcpy(slot, blob, comp_sz);
+        e->origin = BLOB_REUSE;
+    } else if (opts->cache && cache_get(opts->cache, data, size, &w->params, &w->blob)) {
+        comp_sz = w->blob.len;
+        if (comp_sz < size) memcpy(slot, w->blob.data, comp_sz);
+        e->origin = BLOB_CACHE;
+    } else {
+        comp_sz = yaz0_encoder_encode_into(w->enc, data, size,
+                                           slot, yaz0_compress_bound(size));
+        /* Streams that failed or do not pay off are not worth a file */
+        if (opts->cache && comp_sz > 0 && comp_sz < size)
+            cache_put(opts->cache, data, size, &w->params, slot, comp_sz);
+        e->origin = BLOB_ENCODED;
+    }
+
+    if (opts->stats) {
+        e->enc_ns = time_ns() - t0;
+        e->yaz0_sz = comp_sz;
+        if (comp_sz > 0 && (comp_sz < size || e->origin == BLOB_ENCODED))
+            yaz0_count_tokens(slot, comp_sz, &e->literals, &e->matches);
+    }
+    return comp_sz;
+}
+
+/*
+ * Place every file whose stream is ready at the end of the image, in ROM
+ * order; lock held. Stored files are copied from the input. Once placed,
+ * an entry's comp_data points at its bytes in the image, where later
+ * duplicates copy them from.
+ */
+static void job_flush(compress_job_t *job) {
+    for (; job->wpos < job->nfiles; job->wpos++) {
+        dma_entry_t *e = job->files[job->wpos];
+        if (e->dup_of >= 0 && job->opts.share_dups) continue;
+
+        /* A duplicate copies its first occurrence */
+        dma_entry_t *src = (e->dup_of >= 0) ? &job->dma->entries[e->dup_of] : e;
+        job_slot_t *slot = &job->slots[src->index];
+        if (!slot->ready) break;
+
+        e->compress = src->compress;
+        e->comp_sz  = src->comp_sz;
+        size_t sz16 = align16(e->comp_sz);
+        e->pstart = (uint32_t)job->comp_total;
+        if (e->compress) {
+            e->pend = (uint32_t)(e->pstart + sz16);
+            job->total_compressed += sz16;
+        } else {
+            e->pend = 0;
+        }
+
+        /* The image is zeroed, so the padding needs no writing */
+        uint8_t *dst = job->out_rom + job->comp_total;
+        memcpy(dst, src->comp_data, e->comp_sz);
+        job->comp_total += sz16;
+        if (e->compress) {
+            src->comp_data = dst;
+            free(slot->held);
+            slot->held = NULL;
+        }
+    }
+}
+
+/*
+ * Encode one entry into the worker's buffer and place it, with whatever
+ * became ready behind it, if it is next in ROM order; otherwise keep a
+ * copy until it is. If Yaz0 does not pay off, the entry is stored and its
+ * bytes are copied from the input.
+ */
+void compress_job_run(compress_job_t *job, int k, compress_worker_t *w) {
+    dma_entry_t *e = job->order[k];
+    size_t file_size = e->end - e->start;
+    const uint8_t *file_data = job->rom_data + e->start;
+
+    size_t comp_sz = 0;
+    if (buf_try_reserve(&w->stream, yaz0_compress_bound(file_size)))
+        comp_sz = encode_file(&job->opts, w, e, file_data, file_size, w->stream.data);
+    if (comp_sz > 0 && comp_sz < file_size) {
+        e->comp_data = w->stream.data;
+        e->comp_sz = comp_sz;
+    } else {
+        e->compress = 0;
+        e->comp_data = (uint8_t *)file_data;
+        e->comp_sz = file_size;
+    }
+
+    mutex_lock(&job->lock);
+    if (comp_sz == 0 && !job->err) job->err = YED_ERR_NOMEM;
+    job_slot_t *slot = &job->slots[e->index];
+    slot->ready = 1;
+    job_flush(job);
+    if (e->comp_data == w->stream.data) {
+        /* Not placed yet: the buffer is needed for the next entry */
+        slot->held = (uint8_t *)malloc(e->comp_sz);
+        if (slot->held) {
+            memcpy(slot->held, e->comp_data, e->comp_sz);
+            e->comp_data = slot->held;
+        } else {
+            if (!job->err) job->err = YED_ERR_NOMEM;
+            e->compress = 0;
+            e->comp_data = (uint8_t *)file_data;
+            e->comp_sz = file_size;
+        }
+    }
+    job->done++;
+    if (!job->opts.quiet) {
+        fprintf(stderr, "\rprocessing entry %d/%d: ", job->done, job->ntasks);
+        fflush(stderr);
+    }
+    mutex_unlock(&job->lock);
+}
+
+/*
+ * Reset deleted entries, list the entries that carry data in files[] (in
+ * DMA order) and mark duplicates. Returns the number of files, or -1 if
+ * out of memory.
+ */
+static int prepare_entries(const uint8_t *rom_data, dma_table_t *dma,
+                           const compress_opts_t *opts, dma_entry_t **files) {
+    dma_entry_t *entries = dma->entries;
+    int num_entries = dma->num_entries;
+
     for (int i = 0; i < num_entries; i++) {
         if (entries[i].deleted) {
             entries[i].start = entries[i].ostart;
@@ -23,99 +291,652 @@ uint8_t *compress_rom(const uint8_t *rom_data, int mb,
         }
     }
 
-    for (int idx = 0; idx < num_entries; idx++) {
-        dma_entry_t *e = &entries[idx];
-        fprintf(stderr, "\rprocessing entry %d/%d: ", idx + 1, num_entries);
-        fflush(stderr);
+    int nfiles = 0;
+    for (int i = 0; i < num_entries; i++) {
+        entries[i].dup_of = -1;
+        if (entries[i].start == entries[i].end || entries[i].deleted) continue;
+        files[nfiles++] = &entries[i];
+    }
+    int ndups = find_duplicates(dma, rom_data, files, nfiles);
+    if (ndups < 0) return -1;
+    if (ndups > 0 && !opts->quiet)
+        fprintf(stderr, "duplicates: %d files repeat another file's contents%s\n",
+                ndups, opts->share_dups ? " and share its blob" : "");
+    return nfiles;
+}
+
+/* All entries of the table, in ROM order; NULL if out of memory */
+static dma_entry_t **sort_by_ostart(dma_table_t *dma) {
+    int n = dma->num_entries;
+    dma_entry_t **sorted = (dma_entry_t **)malloc((size_t)(n + 1) * sizeof(*sorted));
+    if (!sorted) return NULL;
+    for (int i = 0; i < n; i++) sorted[i] = &dma->entries[i];
+    qsort(sorted, n, sizeof(*sorted), cmp_by_ostart);
+    return sorted;
+}
 
-        if (e->start == e->end || e->deleted) continue;
+/*
+ * Returns NULL if out of memory or, for a file, if it cannot be created;
+ * only the file variant prints an error.
+ */
+static compress_job_t *begin_job(const uint8_t *rom_data, int mb, dma_table_t *dma,
+                                 const compress_opts_t *opts, const char *out_path) {
+    compress_job_t *job = (compress_job_t *)calloc(1, sizeof(*job));
+    int num_entries = dma->num_entries;
+    dma_entry_t **order = (dma_entry_t **)malloc((size_t)(num_entries + 1) * sizeof(*order));
+    job_slot_t *slots = (job_slot_t *)calloc((size_t)num_entries + 1, sizeof(job_slot_t));
+    dma_entry_t **files = NULL;
+    uint8_t *out_rom = NULL;
+    if (!job || !order || !slots) goto nomem;
+    job->rom_data = rom_data;
+    job->mb = mb;
+    job->dma = dma;
+    if (opts) job->opts = *opts;
+    else compress_default_opts(&job->opts);
+    opts = &job->opts;
 
-        size_t file_size = e->end - e->start;
-        const uint8_t *file_data = rom_data + e->start;
+    int nfiles = prepare_entries(rom_data, dma, opts, order);
+    if (nfiles < 0) goto nomem;
 
-        if (!e->compress) {
-            e->comp_data = (uint8_t *)malloc(file_size);
-            if (!e->comp_data) die("out of memory");
-            memcpy(e->comp_data, file_data, file_size);
-            e->comp_sz = file_size;
-            continue;
+    /*
+     * Files are placed in ROM order as their streams become ready. A
+     * stream is only kept if it is smaller than its file, so the image
+     * never grows past the files' own sizes.
+     */
+    files = sort_by_ostart(dma);
+    if (!files) goto nomem;
+    int n = 0;
+    size_t out_cap = 0;
+    for (int si = 0; si < num_entries; si++) {
+        dma_entry_t *e = files[si];
+        if (e->deleted || e->start == e->end) continue;
+        files[n++] = e;
+        if (e->dup_of < 0 || !opts->share_dups)
+            out_cap += align16(e->end - e->start);
+    }
+
+    if (mb != 0 && (size_t)mb * 0x100000 > out_cap)
+        out_cap = (size_t)mb * 0x100000;
+    /* The checksum reads the whole head, whatever the ROM size */
+    if (out_cap < N64CRC_SPAN) out_cap = N64CRC_SPAN;
+    if (out_path) {
+        job->out_path = (char *)malloc(strlen(out_path) + 1);
+        if (!job->out_path) goto nomem;
+        strcpy(job->out_path, out_path);
+        if (!map_file_create(&job->out, out_path, out_cap)) {
+            fprintf(stderr, "error: cannot write '%s'\n", out_path);
+            goto fail;
         }
+        out_rom = job->out.data;
+    } else {
+        out_rom = (uint8_t *)calloc(out_cap, 1);
+        if (!out_rom) goto nomem;
+    }
 
-        size_t comp_sz;
-        uint8_t *comp = yaz0_encode(file_data, file_size, &comp_sz);
+    /* Stored entries are ready as they are; the rest need encoding */
+    int ntasks = 0;
+    for (int k = 0; k < nfiles; k++) {
+        dma_entry_t *e = order[k];
+        if (e->dup_of >= 0) continue;
+        if (e->compress) {
+            order[ntasks++] = e;
+        } else {
+            e->comp_data = (uint8_t *)rom_data + e->start;
+            e->comp_sz = e->end - e->start;
+            slots[e->index].ready = 1;
+        }
+    }
+    qsort(order, ntasks, sizeof(*order), cmp_by_size_desc);
 
-        if (comp_sz >= file_size) {
-            free(comp);
-            e->comp_data = (uint8_t *)malloc(file_size);
-            if (!e->comp_data) die("out of memory");
-            memcpy(e->comp_data, file_data, file_size);
-            e->comp_sz = file_size;
-            e->compress = 0;
+    job->out_rom = out_rom;
+    job->out_cap = out_cap;
+    job->order = order;
+    job->files = files;
+    job->nfiles = n;
+    job->slots = slots;
+    job->ntasks = ntasks;
+    mutex_init(&job->lock);
+    job_flush(job);
+    return job;
+
+nomem:
+    if (out_path) fprintf(stderr, "error: out of memory\n");
+fail:
+    if (job) free(job->out_path);
+    free(job);
+    free(order);
+    free(slots);
+    free(files);
+    return NULL;
+}
+
+compress_job_t *compress_begin(const uint8_t *rom_data, int mb, dma_table_t *dma,
+                               const compress_opts_t *opts) {
+    return begin_job(rom_data, mb, dma, opts, NULL);
+}
+
+compress_job_t *compress_begin_file(const uint8_t *rom_data, int mb, dma_table_t *dma,
+                                    const compress_opts_t *opts, const char *path) {
+    return begin_job(rom_data, mb, dma, opts, path);
+}
+
+/* Runs compress_job_run on the workers of one parallel_for */
+typedef struct {
+    compress_job_t     *job;
+    compress_worker_t **workers;
+} comp_ctx_t;
+
+static void compress_task(void *arg, int k, int worker) {
+    comp_ctx_t *ctx = (comp_ctx_t *)arg;
+    compress_job_run(ctx->job, k, ctx->workers[worker]);
+}
+
+/* Run every entry of a job on a pool of its own; failures go to job->err */
+static void run_job(compress_job_t *job) {
+    int ntasks = job->ntasks;
+
+    /* Entries run in parallel; each encoder runs its split chunks serially */
+    int nworkers = job->opts.yaz0.threads;
+    if (nworkers <= 0) nworkers = cpu_count();
+    if (nworkers > ntasks) nworkers = ntasks;
+    if (nworkers < 1) nworkers = 1;
+
+    comp_ctx_t ctx;
+    ctx.job = job;
+    ctx.workers = (compress_worker_t **)calloc((size_t)nworkers, sizeof(compress_worker_t *));
+    if (!ctx.workers) {
+        job->err = YED_ERR_NOMEM;
+        return;
+    }
+    int ok = 1;
+    for (int w = 0; w < nworkers; w++)
+        if (!(ctx.workers[w] = compress_worker_new(&job->opts))) ok = 0;
+
+    if (ok) parallel_for(nworkers, ntasks, compress_task, &ctx);
+    else job->err = YED_ERR_NOMEM;
+
+    for (int w = 0; w < nworkers; w++)
+        compress_worker_free(ctx.workers[w]);
+    free(ctx.workers);
+}
+
+int compress_rom(const uint8_t *rom_data, int mb, dma_table_t *dma,
+                 const compress_opts_t *opts, uint8_t **out, size_t *out_size) {
+    compress_job_t *job = compress_begin(rom_data, mb, dma, opts);
+    if (!job) return YED_ERR_NOMEM;
+    run_job(job);
+    return compress_end(job, out, out_size);
+}
+
+int compress_rom_mapped(const uint8_t *rom_data, int mb, dma_table_t *dma,
+                        const compress_opts_t *opts, const char *path,
+                        size_t *out_size) {
+    compress_job_t *job = compress_begin_file(rom_data, mb, dma, opts, path);
+    if (!job) return 0;
+    run_job(job);
+    return compress_end_file(job, out_size);
+}
+
+/*
+ * Release what the job kept while its entries ran and point shared
+ * duplicates at their first occurrence's blob. Sets the end of the data
+ * and the ROM size. Returns YED_OK, the error of a failed entry, or
+ * YED_ERR_TOO_BIG if the data does not fit the requested size.
+ */
+static int place_job(compress_job_t *job, size_t *data_end, size_t *rom_size) {
+    const compress_opts_t *opts = &job->opts;
+    dma_entry_t *entries = job->dma->entries;
+    int num_entries = job->dma->num_entries;
+    int mb = job->mb;
+
+    mutex_destroy(&job->lock);
+    for (int i = 0; i < num_entries; i++) {
+        free(job->slots[i].held);
+        entries[i].comp_data = NULL;
+    }
+    free(job->slots);
+    free(job->order);
+    free(job->files);
+    *data_end = 0;
+    *rom_size = 0;
+    if (job->err) return job->err;
+    if (!opts->quiet)
+        fprintf(stderr, "\rprocessing entry %d/%d: success!\n", job->ntasks, job->ntasks);
+
+    size_t total_decompressed = 0;
+    for (int i = 0; i < num_entries; i++) {
+        dma_entry_t *e = &entries[i];
+        if (e->deleted || e->start == e->end) continue;
+        if (e->dup_of >= 0 && opts->share_dups) {
+            const dma_entry_t *first = &entries[e->dup_of];
+            e->compress = first->compress;
+            e->comp_sz  = first->comp_sz;
+            e->pstart   = first->pstart;
+            e->pend     = first->pend;
+        }
+        if (e->compress) total_decompressed += e->end - e->start;
+    }
+
+    size_t comp_total = job->comp_total;
+    *data_end = comp_total;
+    if (mb == 0)
+        *rom_size = align8mb(comp_total);
+    else {
+        *rom_size = (size_t)mb * 0x100000;
+        if (comp_total > *rom_size) return YED_ERR_TOO_BIG;
+    }
+
+    if (total_decompressed > 0 && !opts->quiet)
+        fprintf(stderr, "compression ratio: %.2f%%\n",
+                (double)job->total_compressed / (double)total_decompressed * 100.0);
+    return YED_OK;
+}
+
+/* Checksum the head; only a warning if the boot code is unknown */
+static void update_crc(const compress_opts_t *opts, uint8_t *out_rom) {
+    if (!n64crc(out_rom) && !opts->quiet)
+        fprintf(stderr, "warning: unknown CIC chip, CRC not updated\n");
+}
+
+/* Error line for a failed file job */
+static void print_job_error(const compress_job_t *job, int err, size_t data_end) {
+    if (err == YED_ERR_TOO_BIG)
+        fprintf(stderr, "error: compressed data (%.2f MiB) exceeds %d MiB limit\n",
+                (double)data_end/(1024*1024), job->mb);
+    else
+        fprintf(stderr, "error: %s\n", yed_strerror(err));
+}
+
+int compress_end(compress_job_t *job, uint8_t **out, size_t *out_size) {
+    size_t comp_total, compsz;
+    uint8_t *out_rom = job->out_rom;
+    size_t out_cap = job->out_cap;
+    int err = place_job(job, &comp_total, &compsz);
+
+    /* Everything past the data is still zero; pad or trim to size */
+    if (err == YED_OK && compsz > out_cap) {
+        uint8_t *grown = (uint8_t *)realloc(out_rom, compsz);
+        if (grown) {
+            out_rom = grown;
+            memset(out_rom + out_cap, 0, compsz - out_cap);
         } else {
-            e->comp_data = comp;
-            e->comp_sz = comp_sz;
+            err = YED_ERR_NOMEM;
         }
     }
-    fprintf(stderr, "\rprocessing entry %d/%d: success!\n", num_entries, num_entries);
+    if (err != YED_OK) {
+        free(out_rom);
+        free(job);
+        return err;
+    }
 
-    int sort_idx[MAX_DMA_ENTRIES];
-    for (int i = 0; i < num_entries; i++) sort_idx[i] = i;
-    qsort(sort_idx, num_entries, sizeof(int), cmp_by_ostart);
+    write_dma_table(job->dma, out_rom);
+    update_crc(&job->opts, out_rom);
+    if (compsz < out_cap) {
+        uint8_t *shrunk = (uint8_t *)realloc(out_rom, compsz);
+        if (shrunk) out_rom = shrunk;
+    }
+    free(job);
+    *out = out_rom;
+    *out_size = compsz;
+    return YED_OK;
+}
 
-    size_t comp_total = 0, total_compressed = 0, total_decompressed = 0;
-    for (int si = 0; si < num_entries; si++) {
-        dma_entry_t *e = &entries[sort_idx[si]];
-        if (e->deleted || e->comp_sz == 0) continue;
+int compress_end_file(compress_job_t *job, size_t *out_size) {
+    size_t comp_total = 0, compsz = 0;
+    uint8_t *out_rom = job->out_rom;
+    int err = place_job(job, &comp_total, &compsz);
+    int ok = (err == YED_OK);
+
+    /* The file is cut or zero-extended to size when it is closed */
+    if (ok) {
+        write_dma_table(job->dma, out_rom);
+        update_crc(&job->opts, out_rom);
+    } else {
+        print_job_error(job, err, comp_total);
+    }
+
+    if (!ok) {
+        map_file_abort(&job->out);
+    } else if (!map_file_close(&job->out, comp_total, compsz)) {
+        fprintf(stderr, "error: cannot write '%s'\n", job->out_path);
+        ok = 0;
+    }
+    free(job->out_path);
+    free(job);
+    *out_size = compsz;
+    return ok;
+}
+
+/* --- Streaming writer --- */
+
+#define STREAM_WINDOW  (8 * 1024 * 1024)  /* encoded bytes waiting for the writer */
+
+/* Per-entry state of a streamed compression */
+typedef struct {
+    uint8_t *blob;    /* encoded stream while it waits to be written */
+    int      ready;   /* encoded, or stored as is */
+    int      refs;    /* entries that still have to write it */
+    int      task;    /* index in tasks[], -1 if not encoded */
+} stream_slot_t;
+
+typedef struct {
+    const uint8_t         *rom_data;
+    const compress_opts_t *opts;
+    dma_entry_t           *entries;
+    stream_slot_t         *slots;   /* by entry index */
+    dma_entry_t          **tasks;   /* entries to encode, in write order */
+    int                    ntasks;
+    dma_entry_t          **files;   /* entries with data, in ROM order */
+    int                    nfiles;
+    FILE                  *f;
+    uint8_t               *head;    /* first N64CRC_SPAN bytes of the output */
+    mutex_t                lock;    /* guards everything below */
+    cond_t                 cond;    /* signalled after each finished entry */
+    int                    next;    /* next task to hand out */
+    int                    done;
+    int                    wpos;    /* next file to write */
+    size_t                 pending; /* bytes of blobs not yet released */
+    size_t                 comp_total, total_compressed;
+    int                    failed;  /* a write failed */
+    int                    err;     /* YED_ERR_* of a failed entry */
+} stream_t;
+
+typedef struct {
+    stream_t          *st;
+    compress_worker_t *w;
+} stream_worker_t;
+
+static const uint8_t zero_block[0x10000];
+
+/* Append to the output file, keeping a copy of the head */
+static void stream_put(stream_t *st, const uint8_t *data, size_t len) {
+    if (st->failed) return;
+    if (st->comp_total < N64CRC_SPAN) {
+        size_t n = N64CRC_SPAN - st->comp_total;
+        memcpy(st->head + st->comp_total, data, (n < len) ? n : len);
+    }
+    if (fwrite(data, 1, len, st->f) != len) st->failed = 1;
+    st->comp_total += len;
+}
+
+/* Write every file whose blob is ready, in ROM order; lock held */
+static void stream_flush(stream_t *st) {
+    for (; st->wpos < st->nfiles; st->wpos++) {
+        dma_entry_t *e = st->files[st->wpos];
+        if (e->dup_of >= 0 && st->opts->share_dups) continue;
+
+        /* A duplicate copies its first occurrence */
+        dma_entry_t *src = (e->dup_of >= 0) ? &st->entries[e->dup_of] : e;
+        stream_slot_t *slot = &st->slots[src->index];
+        if (!slot->ready) break;
+
+        e->compress = src->compress;
+        e->comp_sz  = src->comp_sz;
         size_t sz16 = align16(e->comp_sz);
-        e->pstart = (uint32_t)comp_total;
+        e->pstart = (uint32_t)st->comp_total;
         if (e->compress) {
             e->pend = (uint32_t)(e->pstart + sz16);
-            total_compressed += sz16;
-            total_decompressed += e->end - e->start;
+            st->total_compressed += sz16;
         } else {
             e->pend = 0;
         }
-        comp_total += sz16;
+        stream_put(st, e->compress ? slot->blob : st->rom_data + src->start, e->comp_sz);
+        stream_put(st, zero_block, sz16 - e->comp_sz);
+
+        if (--slot->refs == 0 && slot->blob) {
+            st->pending -= src->comp_sz;
+            free(slot->blob);
+            slot->blob = NULL;
+        }
+    }
+}
+
+/* Task the writer is waiting for (ntasks if none); lock held */
+static int stream_need(const stream_t *st) {
+    if (st->wpos >= st->nfiles) return st->ntasks;
+    const dma_entry_t *e = st->files[st->wpos];
+    int src = (e->dup_of >= 0) ? e->dup_of : e->index;
+    return (st->slots[src].task >= 0) ? st->slots[src].task : st->ntasks;
+}
+
+/*
+ * Encode entries in write order. Once more than STREAM_WINDOW bytes wait
+ * for the writer, workers hold off until the entry it needs is written,
+ * unless nobody has picked that entry up yet. After a failed write or
+ * entry no more work is handed out.
+ */
+static void stream_worker(void *arg) {
+    stream_worker_t *sw = (stream_worker_t *)arg;
+    stream_t *st = sw->st;
+
+    mutex_lock(&st->lock);
+    while (st->next < st->ntasks && !st->failed && !st->err) {
+        if (st->pending > STREAM_WINDOW && stream_need(st) < st->next) {
+            cond_wait(&st->cond, &st->lock);
+            continue;
+        }
+        dma_entry_t *e = st->tasks[st->next++];
+        mutex_unlock(&st->lock);
+
+        size_t size = e->end - e->start;
+        uint8_t *blob = (uint8_t *)malloc(yaz0_compress_bound(size));
+        size_t comp_sz = 0;
+        if (blob)
+            comp_sz = encode_file(st->opts, sw->w, e, st->rom_data + e->start, size, blob);
+        if (comp_sz > 0 && comp_sz < size) {
+            uint8_t *shrunk = (uint8_t *)realloc(blob, comp_sz);
+            if (shrunk) blob = shrunk;
+            e->comp_sz = comp_sz;
+        } else {
+            free(blob);
+            blob = NULL;
+            e->compress = 0;
+            e->comp_sz = size;
+        }
+
+        mutex_lock(&st->lock);
+        if (comp_sz == 0 && !st->err) st->err = YED_ERR_NOMEM;
+        stream_slot_t *slot = &st->slots[e->index];
+        slot->blob = blob;
+        slot->ready = 1;
+        if (blob) st->pending += comp_sz;
+        st->done++;
+        if (!st->opts->quiet) {
+            fprintf(stderr, "\rprocessing entry %d/%d: ", st->done, st->ntasks);
+            fflush(stderr);
+        }
+        stream_flush(st);
+        cond_broadcast(&st->cond);
+    }
+    mutex_unlock(&st->lock);
+}
+
+int compress_rom_to_file(const uint8_t *rom_data, int mb, dma_table_t *dma,
+                         const compress_opts_t *opts, const char *path,
+                         size_t *out_size) {
+    compress_opts_t defaults;
+    if (!opts) {
+        compress_default_opts(&defaults);
+        opts = &defaults;
+    }
+
+    int num_entries = dma->num_entries;
+    if (dma->offset + (size_t)num_entries * 16 > N64CRC_SPAN) {
+        fprintf(stderr, "error: DMA table at 0x%X lies beyond the ROM head\n", dma->offset);
+        return 0;
+    }
+
+    stream_t st;
+    memset(&st, 0, sizeof(st));
+    st.rom_data = rom_data;
+    st.opts = opts;
+    st.entries = dma->entries;
+    /* Written under a temporary name, as rom_data may be a mapping of path */
+    char *tmp = temp_path_for(path);
+    st.f = tmp ? fopen(tmp, "wb") : NULL;
+    if (!st.f) {
+        fprintf(stderr, "error: cannot write '%s'\n", path);
+        free(tmp);
+        return 0;
+    }
+
+    st.files = (dma_entry_t **)malloc((size_t)(num_entries + 1) * sizeof(*st.files));
+    st.tasks = (dma_entry_t **)malloc((size_t)(num_entries + 1) * sizeof(*st.tasks));
+    st.slots = (stream_slot_t *)calloc((size_t)num_entries + 1, sizeof(stream_slot_t));
+    st.head = (uint8_t *)calloc(N64CRC_SPAN, 1);
+    dma_entry_t **sorted = NULL;
+    if (!st.files || !st.tasks || !st.slots || !st.head ||
+        prepare_entries(rom_data, dma, opts, st.files) < 0 ||
+        !(sorted = sort_by_ostart(dma))) {
+        fprintf(stderr, "error: out of memory\n");
+        free(st.files);
+        free(st.tasks);
+        free(st.slots);
+        free(st.head);
+        fclose(st.f);
+        remove(tmp);
+        free(tmp);
+        return 0;
+    }
+
+    /* Files in ROM order; each blob is encoded when first written */
+    for (int i = 0; i < num_entries; i++)
+        st.slots[i].task = -1;
+    for (int si = 0; si < num_entries; si++) {
+        dma_entry_t *e = sorted[si];
+        if (e->deleted || e->start == e->end) continue;
+        st.files[st.nfiles++] = e;
+        if (e->dup_of >= 0 && opts->share_dups) continue;
+
+        dma_entry_t *src = (e->dup_of >= 0) ? &st.entries[e->dup_of] : e;
+        stream_slot_t *slot = &st.slots[src->index];
+        slot->refs++;
+        if (!src->compress) {
+            src->comp_sz = src->end - src->start;
+            slot->ready = 1;
+        } else if (slot->task < 0) {
+            slot->task = st.ntasks;
+            st.tasks[st.ntasks++] = src;
+        }
+    }
+    free(sorted);
+
+    int nworkers = opts->yaz0.threads;
+    if (nworkers <= 0) nworkers = cpu_count();
+    if (nworkers > st.ntasks) nworkers = st.ntasks;
+    if (nworkers < 1) nworkers = 1;
+
+    stream_worker_t *workers = (stream_worker_t *)calloc((size_t)nworkers, sizeof(stream_worker_t));
+    thread_t *tids = (thread_t *)malloc((size_t)nworkers * sizeof(thread_t));
+    int started = 0;
+    if (workers && tids) {
+        /* Pool of however many workers could be set up */
+        while (started < nworkers) {
+            workers[started].st = &st;
+            workers[started].w = compress_worker_new(opts);
+            if (!workers[started].w) break;
+            started++;
+        }
+        nworkers = started;
+    }
+    if (started == 0) st.err = YED_ERR_NOMEM;
+    mutex_init(&st.lock);
+    cond_init(&st.cond);
+
+    /* Files stored as is can go out before anything is encoded */
+    stream_flush(&st);
+
+    /* The calling thread is worker 0 */
+    if (nworkers > 0) {
+        started = 1;
+        for (int w = 1; w < nworkers; w++) {
+            if (!thread_start(&tids[w], stream_worker, &workers[w])) break;
+            started++;
+        }
+        stream_worker(&workers[0]);
+        for (int w = 1; w < started; w++)
+            thread_join(tids[w]);
+    }
+
+    cond_destroy(&st.cond);
+    mutex_destroy(&st.lock);
+    for (int w = 0; w < nworkers; w++)
+        compress_worker_free(workers[w].w);
+    free(workers);
+    free(tids);
+    if (!opts->quiet) {
+        if (!st.err && !st.failed)
+            fprintf(stderr, "\rprocessing entry %d/%d: success!\n", st.ntasks, st.ntasks);
+        else
+            fputc('\n', stderr);  /* end the progress line */
+    }
+
+    /* Shared duplicates point at their first occurrence's blob */
+    size_t total_decompressed = 0;
+    for (int k = 0; k < st.nfiles; k++) {
+        dma_entry_t *e = st.files[k];
+        if (e->dup_of >= 0 && opts->share_dups) {
+            const dma_entry_t *first = &st.entries[e->dup_of];
+            e->compress = first->compress;
+            e->comp_sz  = first->comp_sz;
+            e->pstart   = first->pstart;
+            e->pend     = first->pend;
+        }
+        if (e->compress) total_decompressed += e->end - e->start;
     }
+    /* Blobs left unwritten when the workers stopped early */
+    for (int i = 0; i < num_entries; i++)
+        free(st.slots[i].blob);
+    free(st.files);
+    free(st.tasks);
+    free(st.slots);
 
     size_t compsz;
+    int ok = !st.failed && !st.err, reported = 0;
+    if (st.err) {
+        fprintf(stderr, "error: %s\n", yed_strerror(st.err));
+        reported = 1;
+    }
     if (mb == 0)
-        compsz = align8mb(comp_total);
+        compsz = align8mb(st.comp_total);
     else {
         compsz = (size_t)mb * 0x100000;
-        if (comp_total > compsz) {
+        if (st.comp_total > compsz) {
             fprintf(stderr, "error: compressed data (%.2f MiB) exceeds %d MiB limit\n",
-                    (double)comp_total/(1024*1024), mb);
-            exit(1);
+                    (double)st.comp_total/(1024*1024), mb);
+            ok = 0;
+            reported = 1;
         }
     }
 
-    uint8_t *out_rom = (uint8_t *)calloc(compsz, 1);
-    if (!out_rom) die("out of memory");
-
-    int inject_total = 0;
-    for (int i = 0; i < num_entries; i++)
-        if (!entries[i].deleted && entries[i].comp_data) inject_total++;
+    /* Pad, then patch the DMA table and checksum into the head */
+    while (ok && st.comp_total < compsz) {
+        size_t n = compsz - st.comp_total;
+        if (n > sizeof(zero_block)) n = sizeof(zero_block);
+        stream_put(&st, zero_block, n);
+        ok = !st.failed;
+    }
+    if (ok) {
+        write_dma_table(dma, st.head);
+        update_crc(opts, st.head);
+        size_t head_len = (compsz < N64CRC_SPAN) ? compsz : N64CRC_SPAN;
+        ok = fseek(st.f, 0, SEEK_SET) == 0 &&
+             fwrite(st.head, 1, head_len, st.f) == head_len;
+    }
+    if (fclose(st.f) != 0) ok = 0;
+    free(st.head);
+    if (ok) ok = rename_over(tmp, path);
+    if (!ok) remove(tmp);
+    free(tmp);
 
-    int inject_count = 0;
-    for (int si = 0; si < num_entries; si++) {
-        dma_entry_t *e = &entries[sort_idx[si]];
-        if (e->deleted || !e->comp_data) continue;
-        inject_count++;
-        fprintf(stderr, "\rinjecting file %d/%d: ", inject_count, inject_total);
-        fflush(stderr);
-        memcpy(out_rom + e->pstart, e->comp_data, e->comp_sz);
-        free(e->comp_data);
-        e->comp_data = NULL;
+    if (!ok) {
+        if (!reported) fprintf(stderr, "error: cannot write '%s'\n", path);
+        return 0;
     }
-    fprintf(stderr, "\rinjecting file %d/%d: success!\n", inject_total, inject_total);
 
-    if (total_decompressed > 0)
+    if (total_decompressed > 0 && !opts->quiet)
         fprintf(stderr, "compression ratio: %.2f%%\n",
-                (double)total_compressed / (double)total_decompressed * 100.0);
-
-    write_dma_table(out_rom, dma_offset, dma_count);
-    n64crc(out_rom);
+                (double)st.total_compressed / (double)total_decompressed * 100.0);
     *out_size = compsz;
-    return out_rom;
+    return 1;
 }
\ No newline at end of file
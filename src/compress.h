@@ -4,20 +4,106 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#include "yaz0.h"
+#include "dma.h"
+#include "cache.h"
+#include "reuse.h"
+
+/* Settings for compress_rom */
+typedef struct {
+    yaz0_params_t yaz0;    /* encoder settings; threads = entries in parallel */
+    cache_t      *cache;   /* persistent blob cache, NULL = none */
+    reuse_t      *reuse;   /* blobs from an older compressed ROM, NULL = none */
+    int           share_dups;  /* entries with identical contents share one
+                                  blob in the ROM instead of each storing a copy */
+    int           quiet;   /* no progress or summary lines on stderr */
+    int           stats;   /* time each entry and count its tokens into the
+                              dma_entry_t statistics fields */
+} compress_opts_t;
+
+/* Fill in the default settings */
+void compress_default_opts(compress_opts_t *opts);
+
 /*
  * Compress an uncompressed OoT ROM using Yaz0.
- * Uses the global entries[] table (must be populated via parse_dma_table first).
+ * Only touches the given DMA table, so distinct ROMs may be compressed
+ * concurrently.
  *
  *   rom_data   - input ROM buffer
  *   mb         - target output size in MiB (0 = auto-align to 8 MiB boundary)
- *   dma_offset - byte offset of the DMA table
- *   dma_count  - number of DMA entries
+ *   dma        - the ROM's DMA table (from parse_dma_table); updated in place
+ *   opts       - compression settings (NULL = defaults)
+ *   out        - receives a newly allocated buffer with the compressed ROM
  *   out_size   - receives the output ROM size
  *
- * Returns a newly allocated buffer with the compressed ROM.
+ * Returns YED_OK, YED_ERR_TOO_BIG if the data does not fit mb MiB, or
+ * YED_ERR_NOMEM. Prints nothing but progress, and that only without
+ * opts->quiet.
+ */
+int compress_rom(const uint8_t *rom_data, int mb, dma_table_t *dma,
+                 const compress_opts_t *opts, uint8_t **out, size_t *out_size);
+
+/*
+ * compress_rom into a file: the output image is a mapping of path, so
+ * the zero padding at its end is never written and stays sparse.
+ * Returns 1 on success. On failure prints an error, removes the file and
+ * returns 0.
+ */
+int compress_rom_mapped(const uint8_t *rom_data, int mb, dma_table_t *dma,
+                        const compress_opts_t *opts, const char *path,
+                        size_t *out_size);
+
+/*
+ * Like compress_rom, but writes the ROM to path as it goes instead of
+ * building it in memory. Files are encoded and written in ROM order, so
+ * besides the input only a window of finished blobs and the first
+ * N64CRC_SPAN bytes of the output (for the DMA table and checksum,
+ * patched at the end) are held. The file is identical to what
+ * compress_rom returns.
+ *
+ * Returns 1 on success. On failure prints an error, removes the file and
+ * returns 0.
  */
-uint8_t *compress_rom(const uint8_t *rom_data, int mb,
-                      uint32_t dma_offset, int dma_count,
-                      size_t *out_size);
+int compress_rom_to_file(const uint8_t *rom_data, int mb, dma_table_t *dma,
+                         const compress_opts_t *opts, const char *path,
+                         size_t *out_size);
+
+/*
+ * compress_rom in three steps, for callers that run the entries of several
+ * ROMs on one set of threads:
+ *
+ *   compress_begin     sets up the output and returns a job whose
+ *                      compress_job_tasks() entries still need encoding
+ *   compress_job_run   encodes entry k (0 <= k < tasks) and places it once
+ *                      the entries before it in the ROM are; distinct k may
+ *                      run concurrently, each on its own worker
+ *   compress_end       once every entry has run, writes the DMA table and
+ *                      checksum and frees the job
+ *
+ * opts is copied; rom_data and dma must stay valid until compress_end.
+ * compress_begin and compress_worker_new return NULL if out of memory; an
+ * entry that runs out of memory fails the job in compress_end, which
+ * returns as compress_rom does.
+ */
+typedef struct compress_job compress_job_t;
+
+/* Encoder and scratch for one thread; usable with any job of the same opts */
+typedef struct compress_worker compress_worker_t;
+
+compress_worker_t *compress_worker_new(const compress_opts_t *opts);
+void compress_worker_free(compress_worker_t *w);
+
+compress_job_t *compress_begin(const uint8_t *rom_data, int mb, dma_table_t *dma,
+                               const compress_opts_t *opts);
+int compress_job_tasks(const compress_job_t *job);
+void compress_job_run(compress_job_t *job, int k, compress_worker_t *w);
+int compress_end(compress_job_t *job, uint8_t **out, size_t *out_size);
+
+/* The same steps for a mapped output file, as in compress_rom_mapped:
+ * compress_begin_file returns NULL and compress_end_file returns 0 after
+ * printing an error. */
+compress_job_t *compress_begin_file(const uint8_t *rom_data, int mb, dma_table_t *dma,
+                                    const compress_opts_t *opts, const char *path);
+int compress_end_file(compress_job_t *job, size_t *out_size);
 
 #endif /* COMPRESS_H */
\ No newline at end of file
@@ -0,0 +1,143 @@
+#include "corpus.h"
+#include "util.h"
+
+static uint64_t rng_state;
+
+static uint32_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)(rng_state >> 16);
+}
+
+void corpus_seed(uint64_t seed) {
+    rng_state = seed;
+}
+
+uint32_t corpus_rng(void) {
+    return rng();
+}
+
+/* Zero padding broken up by short bursts, like sparse segments */
+static void gen_zeros(uint8_t *p, size_t n) {
+    memset(p, 0, n);
+    for (size_t i = rng() % 4096; i < n; i += 256 + rng() % 4096) {
+        size_t len = 4 + rng() % 61;
+        for (size_t k = 0; k < len && i + k < n; k++)
+            p[i + k] = (uint8_t)rng();
+    }
+}
+
+/* Tiles of smooth RGBA5551 gradients, repeated with small edits */
+static void gen_textures(uint8_t *p, size_t n) {
+    enum { NTILES = 8, TILE = 2048 };
+    static uint8_t tiles[NTILES][TILE];
+    for (int t = 0; t < NTILES; t++) {
+        int r = rng() % 32, g = rng() % 32, b = rng() % 32;
+        for (int i = 0; i < TILE; i += 2) {
+            int x = (i / 2) % 32, y = (i / 2) / 32;
+            int pr = (r + x / 4) & 31, pg = (g + y / 4) & 31, pb = (b + (x ^ y) / 8) & 31;
+            if (rng() % 8 == 0) pb ^= 1;
+            uint16_t px = (uint16_t)(pr << 11 | pg << 6 | pb << 1 | 1);
+            tiles[t][i] = (uint8_t)(px >> 8);
+            tiles[t][i + 1] = (uint8_t)px;
+        }
+    }
+    for (size_t i = 0; i < n; i += TILE) {
+        size_t len = (n - i < TILE) ? n - i : TILE;
+        memcpy(p + i, tiles[rng() % NTILES], len);
+        if (rng() % 4 == 0)
+            for (int k = 0; k < 8; k++) p[i + rng() % len] = (uint8_t)rng();
+    }
+}
+
+static void gen_random(uint8_t *p, size_t n) {
+    for (size_t i = 0; i < n; i++) p[i] = (uint8_t)rng();
+}
+
+/* Message tables: an offset table, then words and control codes */
+static void gen_text(uint8_t *p, size_t n) {
+    static const char *words[] = {
+        "the", "of", "and", "you", "Link", "Zelda", "Hyrule", "Rupees",
+        "sword", "shield", "forest", "temple", "Great", "Fairy", "what",
+        "is", "this", "here", "must", "find", "please", "come", "back",
+        "Kokiri", "Gerudo", "Goron", "Zora", "heart", "piece", "ocarina"
+    };
+    size_t nwords = sizeof(words) / sizeof(words[0]);
+    size_t i = 0, table = n / 16;
+    for (uint32_t id = 0; i + 8 <= table; id++, i += 8) {
+        put32(p, i, 0x00000000u | id);
+        put32(p, i + 4, 0x07000000u | (uint32_t)(table + id * 48));
+    }
+    while (i < n) {
+        int r = rng() % 16;
+        if (r == 0) {
+            p[i++] = (uint8_t)(1 + rng() % 0x1F);        /* control code */
+        } else if (r == 1) {
+            p[i++] = 0x02;                               /* end of message */
+        } else {
+            const char *w = words[rng() % nwords];
+            for (; *w && i < n; w++) p[i++] = (uint8_t)*w;
+            if (i < n) p[i++] = ' ';
+        }
+    }
+}
+
+/* MIPS-like big-endian code: common instruction shapes, random fields */
+static void gen_code(uint8_t *p, size_t n) {
+    static const uint32_t ops[] = {
+        0x27BD0000u, /* addiu sp, sp, imm */
+        0xAFBF0000u, /* sw ra, imm(sp) */
+        0x8FBF0000u, /* lw ra, imm(sp) */
+        0x0C000000u, /* jal */
+        0x00000000u, /* nop */
+        0x03E00008u, /* jr ra */
+        0x24000000u, /* addiu */
+        0x8C000000u, /* lw */
+        0xAC000000u, /* sw */
+        0x3C000000u, /* lui */
+        0x10000000u, /* beq */
+        0x00000021u, /* addu */
+        0xC4000000u, /* lwc1 */
+        0x46000000u  /* cop1 */
+    };
+    size_t nops = sizeof(ops) / sizeof(ops[0]);
+    for (size_t i = 0; i + 4 <= n; i += 4) {
+        uint32_t op = ops[rng() % nops];
+        uint32_t w;
+        if (op == 0x00000000u || op == 0x03E00008u)
+            w = op;
+        else if (op == 0x0C000000u)
+            w = op | (0x00100000u + (rng() % 0x4000) * 4) >> 2;
+        else if (op == 0x00000021u)
+            w = op | (rng() % 32) << 21 | (rng() % 32) << 16 | (rng() % 32) << 11;
+        else
+            w = op | (rng() % 32) << 21 | (rng() % 32) << 16 | (rng() % 64) * 4;
+        put32(p, i, w);
+    }
+}
+
+/* 64 KiB slices of the others, in ROM-like proportions */
+void corpus_mixed(uint8_t *p, size_t n) {
+    enum { SLICE = 0x10000 };
+    for (size_t i = 0; i < n; i += SLICE) {
+        size_t len = (n - i < SLICE) ? n - i : SLICE;
+        switch (rng() % 8) {
+            case 0:          gen_zeros(p + i, len);    break;
+            case 1: case 2:  gen_textures(p + i, len); break;
+            case 3:          gen_random(p + i, len);   break;
+            case 4:          gen_text(p + i, len);     break;
+            default:         gen_code(p + i, len);     break;
+        }
+    }
+}
+
+const corpus_t corpora[] = {
+    { "zeros",    gen_zeros },
+    { "textures", gen_textures },
+    { "random",   gen_random },
+    { "text",     gen_text },
+    { "code",     gen_code },
+    { "mixed",    corpus_mixed },
+};
+const size_t num_corpora = sizeof(corpora) / sizeof(corpora[0]);
\ No newline at end of file
@@ -0,0 +1,29 @@
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Generated inputs shaped like ROM contents, for yaz0bench and the tests.
+ * The generators draw from one pseudo-random sequence, so the same seed
+ * always gives the same bytes.
+ */
+typedef struct {
+    const char *name;
+    void (*gen)(uint8_t *p, size_t n);
+} corpus_t;
+
+extern const corpus_t corpora[];
+extern const size_t   num_corpora;
+
+/* The "mixed" corpus: 64 KiB slices of the others */
+void corpus_mixed(uint8_t *p, size_t n);
+
+/* Restart the sequence the generators draw from */
+void corpus_seed(uint64_t seed);
+
+/* Next value of the sequence */
+uint32_t corpus_rng(void);
+
+#endif /* CORPUS_H */
\ No newline at end of file
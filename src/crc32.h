@@ -0,0 +1,16 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* CRC-32 of data[0..size): the IEEE/zlib variant the N64 boot code check uses */
+uint32_t crc32_calc(const uint8_t *data, size_t size);
+
+/*
+ * Extend crc, the CRC-32 of everything before data, over data[0..size).
+ * Start from 0; crc32_update(crc32_calc(a), b) is the CRC-32 of a then b.
+ */
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t size);
+
+#endif /* CRC32_H */
\ No newline at end of file
@@ -4,10 +4,72 @@
 #include "n64crc.h"
 #include "dma.h"
 #include "romdb.h"
+#include "thread.h"
+#include "mapfile.h"
+#include "yaz0encdec.h"
 
-uint8_t *do_decompress_rom(const uint8_t *comp, size_t comp_size, size_t *out_size) {
+/* One DMA entry to unpack */
+typedef struct {
+    int      index;
+    uint32_t vstart, vend;
+    uint32_t pstart, pend;
+    int      err;       /* YAZ0_ERR_* from the decoder */
+} dec_job_t;
+
+typedef struct {
+    const uint8_t *comp;
+    uint8_t       *dec;
+    dec_job_t     *jobs;
+    int            njobs;
+    int            quiet;
+    mutex_t        lock;   /* guards done and the progress line */
+    int            done;
+} dec_ctx_t;
+
+static int cmp_by_vstart(const void *a, const void *b) {
+    const dec_job_t *ja = (const dec_job_t *)a, *jb = (const dec_job_t *)b;
+    if (ja->vstart < jb->vstart) return -1;
+    if (ja->vstart > jb->vstart) return 1;
+    return 0;
+}
+
+/* Largest decompressed size first; ties in DMA order */
+static int cmp_by_size_desc(const void *a, const void *b) {
+    const dec_job_t *ja = (const dec_job_t *)a, *jb = (const dec_job_t *)b;
+    uint32_t sa = ja->vend - ja->vstart, sb = jb->vend - jb->vstart;
+    if (sa != sb) return (sa > sb) ? -1 : 1;
+    return ja->index - jb->index;
+}
+
+static void decode_task(void *arg, int k, int worker) {
+    dec_ctx_t *ctx = (dec_ctx_t *)arg;
+    dec_job_t *j = &ctx->jobs[k];
+    uint32_t size = j->vend - j->vstart;
+    (void)worker;
+
+    if (j->pend != 0) {
+        /* Compressed file */
+        size_t n;
+        j->err = yaz0_decode_checked(ctx->comp + j->pstart, j->pend - j->pstart,
+                                     ctx->dec + j->vstart, size, &n);
+    } else {
+        /* Uncompressed - straight copy */
+        memcpy(ctx->dec + j->vstart, ctx->comp + j->pstart, size);
+    }
+
+    if (ctx->quiet) return;
+    mutex_lock(&ctx->lock);
+    ctx->done++;
+    fprintf(stderr, "\rdecompressing entry %d/%d ", ctx->done, ctx->njobs);
+    fflush(stderr);
+    mutex_unlock(&ctx->lock);
+}
+
+/* Identify a compressed ROM; NULL, with the supported list unless quiet,
+ * if it is not recognized */
+static const rom_version_t *detect(const uint8_t *comp, size_t comp_size, int quiet) {
     const rom_version_t *ver = detect_rom_version(comp, comp_size);
-    if (!ver) {
+    if (!ver && !quiet) {
         fprintf(stderr,
             "error: could not identify ROM version.\n"
             "Supported versions:\n");
@@ -15,30 +77,56 @@ uint8_t *do_decompress_rom(const uint8_t *comp, size_t comp_size, size_t *out_si
             fprintf(stderr, "  %-22s  build: %s  @ 0x%X\n",
                     rom_versions[i].name, rom_versions[i].build_date,
                     rom_versions[i].build_offset);
-        exit(1);
     }
+    return ver;
+}
 
+/*
+ * Decompressed size: exactly the highest vrom end in the DMA table, or
+ * the end of the header checksum span or of the table itself if a ROM
+ * is that small. It does not depend on comp_size.
+ */
+static size_t decompressed_size(const uint8_t *comp, size_t comp_size,
+                                const rom_version_t *ver) {
     size_t dma_start = ver->dma_offset;
-    int dma_num = ver->dma_count;
+    size_t max_vend = dma_start + (size_t)ver->dma_count * 16;
+    if (max_vend < N64CRC_SPAN) max_vend = N64CRC_SPAN;
+    for (int i = 0; i < ver->dma_count; i++) {
+        size_t eofs = dma_start + (size_t)i * 16;
+        if (eofs + 16 > comp_size) break;
+        uint32_t vend = get32(comp, eofs + 4);
+        if (vend != DMA_DELETED && vend > max_vend)
+            max_vend = vend;
+    }
+    return max_vend;
+}
 
-    fprintf(stderr, "detected: %s\n", ver->name);
-    fprintf(stderr, "dmadata at 0x%X with %d entries\n",
-            (unsigned)dma_start, dma_num);
+/*
+ * Unpack every file of comp into dec[0..dst_size), which must be zeroed.
+ * Returns YED_OK or an error code; unless quiet, errors are also printed
+ * with the entry they concern.
+ */
+static int decompress_into(const uint8_t *comp, size_t comp_size,
+                           const rom_version_t *ver, int threads, int quiet,
+                           uint8_t *dec, size_t dst_size) {
+    size_t dma_start = ver->dma_offset;
+    int dma_num = ver->dma_count;
 
-    /* Determine decompressed size (scan vend values) */
-    size_t dst_size = comp_size;
-    for (int i = 0; i < dma_num; i++) {
-        uint32_t vend = get32(comp, dma_start + (size_t)i * 16 + 4);
-        if (vend > dst_size)
-            dst_size *= 2;
+    if (!quiet) {
+        fprintf(stderr, "detected: %s\n", ver->name);
+        fprintf(stderr, "dmadata at 0x%X with %d entries\n",
+                (unsigned)dma_start, dma_num);
+    }
+    if (dma_start + (size_t)dma_num * 16 > comp_size) {
+        if (!quiet) fprintf(stderr, "error: dmadata lies outside the ROM\n");
+        return YED_ERR_DMA;
     }
 
-    uint8_t *dec = (uint8_t *)calloc(dst_size, 1);
-    if (!dec) die("out of memory");
+    /* Collect the entries that carry data */
+    dec_job_t *jobs = (dec_job_t *)malloc((size_t)(dma_num + 1) * sizeof(dec_job_t));
+    if (!jobs) return YED_ERR_NOMEM;
+    int njobs = 0;
 
-    int decomp_count = 0, copy_count = 0;
-
-    /* Process each DMA entry */
     for (int i = 0; i < dma_num; i++) {
         size_t eofs = dma_start + (size_t)i * 16;
 
@@ -53,24 +141,71 @@ uint8_t *do_decompress_rom(const uint8_t *comp, size_t comp_size, size_t *out_si
             vend <= vstart || (pend && pend == pstart))
             continue;
 
-        fprintf(stderr, "\rdecompressing entry %d/%d ", i + 1, dma_num);
-        fflush(stderr);
+        uint32_t pfile_end = pend ? pend : pstart + (vend - vstart);
+        if (pfile_end < pstart || pfile_end > comp_size || vend > dst_size) {
+            if (!quiet) fprintf(stderr, "error: entry %d lies outside the ROM\n", i);
+            free(jobs);
+            return YED_ERR_DMA;
+        }
+
+        dec_job_t *j = &jobs[njobs++];
+        j->index  = i;
+        j->vstart = vstart;
+        j->vend   = vend;
+        j->pstart = pstart;
+        j->pend   = pend;
+        j->err    = YAZ0_OK;
+    }
+
+    /* Entries are decoded concurrently, so their outputs must not overlap */
+    qsort(jobs, (size_t)njobs, sizeof(dec_job_t), cmp_by_vstart);
+    for (int k = 1; k < njobs; k++) {
+        if (jobs[k].vstart < jobs[k - 1].vend) {
+            if (!quiet)
+                fprintf(stderr, "error: entries %d and %d overlap in vrom\n",
+                        jobs[k - 1].index, jobs[k].index);
+            free(jobs);
+            return YED_ERR_DMA;
+        }
+    }
+
+    /* Largest first, so the long decodes start early and small ones fill in */
+    qsort(jobs, (size_t)njobs, sizeof(dec_job_t), cmp_by_size_desc);
 
-        if (pend != 0) {
-            /* Compressed file */
-            uint32_t sz = pend - pstart;
-            yaz0_decode(comp, pstart, sz, dec, vstart);
+    dec_ctx_t ctx;
+    ctx.comp = comp;
+    ctx.dec = dec;
+    ctx.jobs = jobs;
+    ctx.njobs = njobs;
+    ctx.quiet = quiet;
+    ctx.done = 0;
+    mutex_init(&ctx.lock);
+
+    parallel_for(threads, njobs, decode_task, &ctx);
+    mutex_destroy(&ctx.lock);
+
+    int decomp_count = 0, copy_count = 0;
+    for (int k = 0; k < njobs; k++) {
+        if (jobs[k].err != YAZ0_OK) {
+            int err = jobs[k].err;
+            if (!quiet)
+                fprintf(stderr, "\nerror: entry %d: %s\n",
+                        jobs[k].index, yaz0_strerror(err));
+            free(jobs);
+            return err;
+        }
+        if (jobs[k].pend != 0)
             decomp_count++;
-        } else {
-            /* Uncompressed - straight copy */
-            uint32_t size = vend - vstart;
-            memcpy(dec + vstart, comp + pstart, size);
+        else
             copy_count++;
-        }
     }
-    fprintf(stderr, "\rdecompressing entry %d/%d: done!    \n", dma_num, dma_num);
-    fprintf(stderr, "decompressed %d files, copied %d uncompressed files\n",
-            decomp_count, copy_count);
+    free(jobs);
+
+    if (!quiet) {
+        fprintf(stderr, "\rdecompressing entry %d/%d: done!    \n", njobs, njobs);
+        fprintf(stderr, "decompressed %d files, copied %d uncompressed files\n",
+                decomp_count, copy_count);
+    }
 
     /* Build updated DMA table in dec: pstart=vstart, pend=0 */
     for (int i = 0; i < dma_num; i++) {
@@ -98,8 +233,53 @@ uint8_t *do_decompress_rom(const uint8_t *comp, size_t comp_size, size_t *out_si
     }
 
     /* Update CRC */
-    n64crc(dec);
+    if (!n64crc(dec) && !quiet)
+        fprintf(stderr, "warning: unknown CIC chip, CRC not updated\n");
+    return YED_OK;
+}
+
+int decompress_rom(const uint8_t *comp, size_t comp_size, int threads, int quiet,
+                   uint8_t **out, size_t *out_size) {
+    const rom_version_t *ver = detect(comp, comp_size, quiet);
+    if (!ver) return YED_ERR_UNKNOWN_ROM;
+    size_t dst_size = decompressed_size(comp, comp_size, ver);
+
+    uint8_t *dec = (uint8_t *)calloc(dst_size, 1);
+    if (!dec) return YED_ERR_NOMEM;
+    int err = decompress_into(comp, comp_size, ver, threads, quiet, dec, dst_size);
+    if (err != YED_OK) {
+        free(dec);
+        return err;
+    }
+
+    *out = dec;
+    *out_size = dst_size;
+    return YED_OK;
+}
+
+int decompress_rom_to_file(const uint8_t *comp, size_t comp_size, int threads,
+                           const char *path, size_t *out_size) {
+    const rom_version_t *ver = detect(comp, comp_size, 0);
+    if (!ver) return 0;
+    size_t dst_size = decompressed_size(comp, comp_size, ver);
+
+    mapped_file_t out;
+    if (!map_file_create(&out, path, dst_size)) {
+        fprintf(stderr, "error: cannot write '%s'\n", path);
+        return 0;
+    }
+    int err = decompress_into(comp, comp_size, ver, threads, 0, out.data, dst_size);
+    if (err == YED_ERR_NOMEM)
+        fprintf(stderr, "error: %s\n", yed_strerror(err));
+    if (err != YED_OK) {
+        map_file_abort(&out);
+        return 0;
+    }
+    if (!map_file_close(&out, dst_size, dst_size)) {
+        fprintf(stderr, "error: cannot write '%s'\n", path);
+        return 0;
+    }
 
     *out_size = dst_size;
-    return dec;
+    return 1;
 }
\ No newline at end of file
@@ -7,9 +7,24 @@
 /*
  * Decompress a compressed OoT ROM.
  * Detects the ROM version and uses its known dmadata offset.
- * Returns a newly allocated buffer with the decompressed ROM.
- * Sets *out_size to the decompressed size.
+ * DMA entries are unpacked on up to `threads` workers (0 = one per CPU),
+ * largest first; entries whose vrom ranges overlap are rejected.
+ * The output ends exactly at the highest vrom end, without padding.
+ *
+ * On success returns YED_OK, stores a newly allocated buffer with the
+ * decompressed ROM in *out and its size in *out_size. Otherwise returns
+ * YED_ERR_UNKNOWN_ROM, YED_ERR_DMA, YED_ERR_NOMEM or the YAZ0_ERR_* code
+ * of a damaged file. Unless quiet, progress and errors go to stderr.
  */
-uint8_t *do_decompress_rom(const uint8_t *comp, size_t comp_size, size_t *out_size);
+int decompress_rom(const uint8_t *comp, size_t comp_size, int threads, int quiet,
+                   uint8_t **out, size_t *out_size);
+
+/*
+ * Like decompress_rom, but unpacks straight into a mapping of path.
+ * Returns 1 on success; on failure prints an error, leaves path as it
+ * was and returns 0.
+ */
+int decompress_rom_to_file(const uint8_t *comp, size_t comp_size, int threads,
+                           const char *path, size_t *out_size);
 
 #endif /* DECOMPRESS_H */
\ No newline at end of file
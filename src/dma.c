@@ -1,16 +1,22 @@
 #include "dma.h"
 #include "util.h"
+#include "yaz0encdec.h"
 
-dma_entry_t entries[MAX_DMA_ENTRIES];
-int          num_entries = 0;
-
-void parse_dma_table(const uint8_t *rom_data, uint32_t offset, int count) {
-    if (count > MAX_DMA_ENTRIES) die("too many DMA entries");
-    num_entries = count;
+int parse_dma_table(dma_table_t *t, const uint8_t *rom_data, size_t rom_size,
+                    uint32_t offset, int count) {
+    t->entries = NULL;
+    t->num_entries = 0;
+    t->offset = offset;
+    if (count < 0 || count > MAX_DMA_ENTRIES ||
+        (size_t)offset + (size_t)count * 16 > rom_size)
+        return YED_ERR_DMA;
+    t->entries = (dma_entry_t *)calloc((size_t)count + 1, sizeof(dma_entry_t));
+    if (!t->entries) return YED_ERR_NOMEM;
+    t->num_entries = count;
 
     for (int i = 0; i < count; i++) {
         size_t raw_ofs = offset + (size_t)i * 16;
-        dma_entry_t *e = &entries[i];
+        dma_entry_t *e = &t->entries[i];
         e->index  = i;
         e->start  = get32(rom_data, raw_ofs);
         e->end    = get32(rom_data, raw_ofs + 4);
@@ -20,8 +26,14 @@ void parse_dma_table(const uint8_t *rom_data, uint32_t offset, int count) {
         e->oend   = e->end;
         e->compress  = 0;
         e->deleted   = 0;
+        e->dup_of    = -1;
         e->comp_data = NULL;
         e->comp_sz   = 0;
+        e->origin    = BLOB_NONE;
+        e->enc_ns    = 0;
+        e->yaz0_sz   = 0;
+        e->literals  = 0;
+        e->matches   = 0;
 
         if (e->pstart == DMA_DELETED && e->pend == DMA_DELETED) {
             e->deleted = 1;
@@ -29,18 +41,24 @@ void parse_dma_table(const uint8_t *rom_data, uint32_t offset, int count) {
             e->ostart = e->oend = 0;
             e->pstart = e->pend = 0;
         } else if (e->pend != 0 && e->pend != DMA_DELETED) {
-            fprintf(stderr, "error: DMA entry %d (%08X %08X %08X %08X) "
-                    "suggests the ROM is already compressed\n",
-                    i, e->start, e->end, e->pstart, e->pend);
-            exit(1);
+            free_dma_table(t);
+            return YED_ERR_COMPRESSED;
         }
     }
+    return YED_OK;
+}
+
+void free_dma_table(dma_table_t *t) {
+    free(t->entries);
+    t->entries = NULL;
+    t->num_entries = 0;
 }
 
-void validate_dma(size_t rom_size) {
+int validate_dma(const dma_table_t *t, size_t rom_size) {
+    const dma_entry_t *entries = t->entries;
     int idx[MAX_DMA_ENTRIES];
     int n = 0;
-    for (int i = 0; i < num_entries; i++)
+    for (int i = 0; i < t->num_entries; i++)
         if (entries[i].start != 0 || entries[i].end != 0)
             idx[n++] = i;
 
@@ -53,57 +71,62 @@ void validate_dma(size_t rom_size) {
 
     uint32_t lowest = 0;
     for (int i = 0; i < n; i++) {
-        dma_entry_t *e = &entries[idx[i]];
+        const dma_entry_t *e = &entries[idx[i]];
         if (e->deleted) continue;
-        if (e->end < e->start) die("DMA invalid entry");
-        if ((e->start & 3) || (e->end & 3)) die("DMA unaligned pointer");
-        if (e->end > rom_size) die("DMA entry exceeds ROM size");
-        if (e->start < lowest) die("DMA entry overlaps previous");
+        if (e->end < e->start ||               /* inverted */
+            (e->start & 3) || (e->end & 3) ||  /* unaligned */
+            e->end > rom_size ||               /* past the ROM */
+            e->start < lowest)                 /* overlaps the previous one */
+            return YED_ERR_DMA;
         lowest = e->end;
     }
+    return YED_OK;
 }
 
-/* Sort comparators */
+/* Sort comparators, on entry pointers; ties keep DMA order */
 
 static int cmp_by_size_desc(const void *a, const void *b) {
-    int ia = *(const int *)a, ib = *(const int *)b;
-    uint32_t sa = entries[ia].end - entries[ia].start;
-    uint32_t sb = entries[ib].end - entries[ib].start;
+    const dma_entry_t *ea = *(const dma_entry_t *const *)a;
+    const dma_entry_t *eb = *(const dma_entry_t *const *)b;
+    uint32_t sa = ea->end - ea->start;
+    uint32_t sb = eb->end - eb->start;
     if (sa > sb) return -1;
     if (sa < sb) return 1;
-    return 0;
+    return ea->index - eb->index;
 }
 
 static int cmp_by_start_asc(const void *a, const void *b) {
-    int ia = *(const int *)a, ib = *(const int *)b;
-    if (entries[ia].start < entries[ib].start) return -1;
-    if (entries[ia].start > entries[ib].start) return 1;
-    return 0;
+    const dma_entry_t *ea = *(const dma_entry_t *const *)a;
+    const dma_entry_t *eb = *(const dma_entry_t *const *)b;
+    if (ea->start < eb->start) return -1;
+    if (ea->start > eb->start) return 1;
+    return ea->index - eb->index;
 }
 
-void write_dma_table(uint8_t *out, uint32_t dma_offset, int dma_count) {
-    int sorted_idx[MAX_DMA_ENTRIES];
-    for (int i = 0; i < num_entries; i++) sorted_idx[i] = i;
-    qsort(sorted_idx, num_entries, sizeof(int), cmp_by_size_desc);
+void write_dma_table(const dma_table_t *t, uint8_t *out) {
+    int n = t->num_entries;
+    const dma_entry_t *sorted[MAX_DMA_ENTRIES];
+    for (int i = 0; i < n; i++) sorted[i] = &t->entries[i];
+    qsort(sorted, n, sizeof(*sorted), cmp_by_size_desc);
 
     int num_used = 0;
-    for (int i = 0; i < num_entries; i++) {
-        if (entries[sorted_idx[i]].start == entries[sorted_idx[i]].end) break;
+    for (int i = 0; i < n; i++) {
+        if (sorted[i]->start == sorted[i]->end) break;
         num_used++;
     }
-    qsort(sorted_idx, num_used, sizeof(int), cmp_by_start_asc);
+    qsort(sorted, num_used, sizeof(*sorted), cmp_by_start_asc);
 
-    memset(out + dma_offset, 0, (size_t)dma_count * 16);
+    memset(out + t->offset, 0, (size_t)n * 16);
 
-    size_t ofs = dma_offset;
+    size_t ofs = t->offset;
     for (int i = 0; i < num_used; i++) {
-        dma_entry_t *e = &entries[sorted_idx[i]];
+        const dma_entry_t *e = sorted[i];
         put32(out, ofs, e->start); put32(out, ofs+4, e->end);
         put32(out, ofs+8, e->pstart); put32(out, ofs+12, e->pend);
         ofs += 16;
     }
-    for (int i = num_used; i < num_entries; i++) {
-        dma_entry_t *e = &entries[sorted_idx[i]];
+    for (int i = num_used; i < n; i++) {
+        const dma_entry_t *e = sorted[i];
         put32(out, ofs, e->start); put32(out, ofs+4, e->end);
         put32(out, ofs+8, e->pstart); put32(out, ofs+12, e->pend);
         ofs += 16;
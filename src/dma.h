@@ -7,6 +7,12 @@
 #define DMA_DELETED      0xFFFFFFFFu
 #define MAX_DMA_ENTRIES  8192
 
+/* Where an entry's blob came from (dma_entry_t.origin) */
+#define BLOB_NONE     0  /* stored by configuration, never encoded */
+#define BLOB_ENCODED  1
+#define BLOB_CACHE    2
+#define BLOB_REUSE    3
+
 typedef struct {
     int      index;
     uint32_t start, end;
@@ -14,25 +20,44 @@ typedef struct {
     uint32_t ostart, oend;
     int      compress;
     int      deleted;
+    int      dup_of;     /* earlier entry with identical contents, -1 if none */
     uint8_t *comp_data;
     size_t   comp_sz;
+    int      origin;     /* BLOB_*, set by compression */
+    /* Statistics, filled in by compression when opts->stats is set */
+    uint64_t enc_ns;     /* wall time spent producing the blob */
+    size_t   yaz0_sz;    /* length of the Yaz0 stream, even if it was stored */
+    uint32_t literals;   /* tokens in the blob */
+    uint32_t matches;
 } dma_entry_t;
 
-/* Global DMA entry table (populated by parse_dma_table) */
-extern dma_entry_t entries[MAX_DMA_ENTRIES];
-extern int          num_entries;
+/*
+ * DMA table of one ROM. All per-ROM state lives here, so separate tables
+ * can be worked on concurrently.
+ */
+typedef struct {
+    dma_entry_t *entries;
+    int          num_entries;
+    uint32_t     offset;     /* byte offset of the table in the ROM */
+} dma_table_t;
 
 /*
- * Parse DMA table from ROM data.
+ * Parse DMA table from ROM data into t (release with free_dma_table).
  *   offset   - byte offset of the DMA table in the ROM
  *   count    - number of entries
+ * Returns YED_OK, YED_ERR_DMA if the table does not fit the ROM,
+ * YED_ERR_COMPRESSED if an entry is compressed or YED_ERR_NOMEM.
  */
-void parse_dma_table(const uint8_t *rom_data, uint32_t offset, int count);
+int parse_dma_table(dma_table_t *t, const uint8_t *rom_data, size_t rom_size,
+                    uint32_t offset, int count);
+
+/* Release the entries of a parsed table */
+void free_dma_table(dma_table_t *t);
 
-/* Validate DMA table entries for consistency */
-void validate_dma(size_t rom_size);
+/* Validate DMA table entries for consistency: YED_OK or YED_ERR_DMA */
+int validate_dma(const dma_table_t *t, size_t rom_size);
 
 /* Write the DMA table into the output ROM buffer */
-void write_dma_table(uint8_t *out, uint32_t dma_offset, int dma_count);
+void write_dma_table(const dma_table_t *t, uint8_t *out);
 
 #endif /* DMA_H */
\ No newline at end of file
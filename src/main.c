@@ -1,13 +1,18 @@
+#include "cli.h"
 #include "util.h"
 #include "romdb.h"
 #include "dma.h"
 #include "compress.h"
 #include "decompress.h"
-
-#include <dirent.h>
-#include <sys/stat.h>
+#include "batch.h"
+#include "stats.h"
+#include "verify.h"
+#include "mapfile.h"
+#include "yaz0.h"
+#include "yaz0encdec.h"
 
 #define MB_DEFAULT 32
+#define CACHE_MIB_DEFAULT 512
 
 static void usage(void) {
     fprintf(stderr,
@@ -17,6 +22,7 @@ static void usage(void) {
         "    yaz0encdec --compress --in <rom.z64> --out <compressed.z64>\n"
         "    yaz0encdec --decompress --in <compressed.z64> --out <decompressed.z64>\n"
         "    yaz0encdec --batch --in <source_dir> --out <target_dir>\n"
+        "    yaz0encdec --verify --in <compressed.z64> [--source <decompressed.z64>]\n"
         "\n"
         "Options:\n"
         "    --in <file>       Input ROM file (or source directory for --batch)\n"
@@ -24,144 +30,47 @@ static void usage(void) {
         "    --compress, -c    Compress a decompressed ROM\n"
         "    --decompress, -d  Decompress a compressed ROM\n"
         "    --batch           Compress all recognized ROMs from --in dir to --out dir\n"
+        "    --level <1-3>     Compression level: 1 = greedy (fastest),\n"
+        "                      2 = lazy (default), 3 = optimal (smallest)\n"
+        "    --engine <hc|bt>  Match finder: hash chains or binary trees\n"
+        "                      (default: bt for level 3, hc otherwise)\n"
+        "    --threads <n>     Worker threads (0 = one per CPU, default 1)\n"
+        "    --split <KiB>     Encode files larger than this as independent chunks\n"
+        "    --cache-dir <dir> Reuse Yaz0 blobs from earlier runs stored in dir\n"
+        "    --cache-size <n>  Cache size limit in MiB (default 512)\n"
+        "    --reuse <file>    Reuse matching Yaz0 blobs from an older compressed ROM\n"
+        "    --share-dups      Store files with identical contents only once\n"
+        "    --stream          Write the compressed ROM while compressing (less memory)\n"
+        "    --stats <file>    --compress: write per-file timings, sizes and token\n"
+        "                      counts to file (.csv for CSV, JSON otherwise)\n"
+        "    --verify          Check a compressed ROM: DMA bounds and overlaps, and that\n"
+        "                      every file decodes (and matches --source, if given);\n"
+        "                      with --compress or --batch, checks each output ROM;\n"
+        "                      runs one thread per CPU unless --threads is given\n"
+        "    --source <file>   --verify: the uncompressed ROM to compare files with\n"
+        "    --jobs <n>        --batch: ROMs compressed at once (0 = no limit, default 1)\n"
+        "    --max-memory <n>  --batch: memory budget in MiB for ROMs in flight\n"
         "\n"
     );
     exit(1);
 }
 
-static uint8_t *load_file(const char *path, long *out_len) {
-    FILE *f = fopen(path, "rb");
-    if (!f) return NULL;
-    fseek(f, 0, SEEK_END);
-    long len = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    uint8_t *data = (uint8_t *)malloc(len);
-    if (!data) { fclose(f); return NULL; }
-    if (fread(data, 1, len, f) != (size_t)len) { free(data); fclose(f); return NULL; }
-    fclose(f);
-    *out_len = len;
-    return data;
-}
-
-static int write_file(const char *path, const uint8_t *data, size_t size) {
-    FILE *f = fopen(path, "wb");
-    if (!f) return 0;
-    size_t written = fwrite(data, 1, size, f);
-    fclose(f);
-    return written == size;
-}
-
-static void ensure_dir(const char *path) {
-#ifdef _WIN32
-    mkdir(path);
-#else
-    mkdir(path, 0755);
-#endif
-}
-
-static int has_z64_ext(const char *name) {
-    size_t len = strlen(name);
-    if (len < 4) return 0;
-    return strcmp(name + len - 4, ".z64") == 0;
-}
-
-static int do_batch(const char *in_dir, const char *out_dir) {
-    if (!in_dir)  die("--batch requires --in <source directory>");
-    if (!out_dir) die("--batch requires --out <target directory>");
-    if (strcmp(in_dir, out_dir) == 0)
-        die("--in and --out cannot be the same directory");
-
-    DIR *dir = opendir(in_dir);
-    if (!dir) {
-        fprintf(stderr, "error: cannot open directory '%s'\n", in_dir);
-        return 1;
+/* Report what the blob cache and the reuse index did, then free them */
+static void close_blob_sources(compress_opts_t *opts, mapped_file_t *reuse_rom) {
+    if (opts->reuse) {
+        reuse_stats_t rs;
+        reuse_get_stats(opts->reuse, &rs);
+        fprintf(stderr, "reuse: %d files reused, %d not found\n",
+                rs.reused, rs.not_found);
+        reuse_close(opts->reuse);
     }
-
-    ensure_dir(out_dir);
-
-    int total = 0, success = 0, skipped = 0;
-
-    struct dirent *ent;
-    while ((ent = readdir(dir)) != NULL) {
-        if (!has_z64_ext(ent->d_name))
-            continue;
-
-        total++;
-
-        /* Build input path */
-        char in_path[1024];
-        snprintf(in_path, sizeof(in_path), "%s/%s", in_dir, ent->d_name);
-
-        fprintf(stderr, "\n=== [%d] %s ===\n", total, ent->d_name);
-        fprintf(stderr, "loading '%s'...\n", in_path);
-
-        long rom_len = 0;
-        uint8_t *rom_data = load_file(in_path, &rom_len);
-        if (!rom_data) {
-            fprintf(stderr, "error: cannot read '%s', skipping\n", in_path);
-            skipped++;
-            continue;
-        }
-        fprintf(stderr, "ROM size: %ld bytes (%.1f MiB)\n",
-                rom_len, (double)rom_len / (1024 * 1024));
-
-        /* Detect ROM version */
-        const rom_version_t *detected = detect_rom_version(rom_data, (size_t)rom_len);
-        if (!detected) {
-            fprintf(stderr, "warning: could not identify ROM version for '%s', skipping\n",
-                    ent->d_name);
-            free(rom_data);
-            skipped++;
-            continue;
-        }
-        fprintf(stderr, "detected: %s\n", detected->name);
-
-        uint32_t dma_offset = detected->dma_offset;
-        int dma_count = detected->dma_count;
-
-        fprintf(stderr, "DMA table: 0x%X, %d entries\n", dma_offset, dma_count);
-
-        /* Reset global state before each ROM */
-        memset(entries, 0, sizeof(entries));
-        num_entries = 0;
-
-        parse_dma_table(rom_data, dma_offset, dma_count);
-        validate_dma((size_t)rom_len);
-        apply_rom_config(detected);
-
-        int comp_count = 0;
-        for (int i = 0; i < num_entries; i++)
-            if (entries[i].compress) comp_count++;
-        fprintf(stderr, "files to compress: %d\n", comp_count);
-
-        size_t out_rom_size;
-        uint8_t *out_rom = compress_rom(rom_data, MB_DEFAULT, dma_offset, dma_count,
-                                         &out_rom_size);
-        free(rom_data);
-
-        /* Build output path */
-        char out_path[1024];
-        snprintf(out_path, sizeof(out_path), "%s/%s", out_dir, ent->d_name);
-
-        if (!write_file(out_path, out_rom, out_rom_size)) {
-            fprintf(stderr, "error: cannot write '%s'\n", out_path);
-            free(out_rom);
-            skipped++;
-            continue;
-        }
-
-        free(out_rom);
-        fprintf(stderr, "compressed ROM written to '%s'\n", out_path);
-        success++;
+    map_file_close(reuse_rom, 0, 0);
+    if (opts->cache) {
+        cache_stats_t cs;
+        cache_close(opts->cache, &cs);
+        fprintf(stderr, "cache: %d hits, %d misses, %d stored, %d evicted\n",
+                cs.hits, cs.misses, cs.stores, cs.evicted);
     }
-
-    closedir(dir);
-
-    fprintf(stderr, "\n=== batch complete ===\n");
-    fprintf(stderr, "total: %d, compressed: %d, skipped: %d\n",
-            total, success, skipped);
-
-    return (success > 0) ? 0 : 1;
 }
 
 int main(int argc, char **argv) {
@@ -172,6 +81,19 @@ int main(int argc, char **argv) {
     int do_compress = 0;
     int do_decompress = 0;
     int batch_mode = 0;
+    compress_opts_t opts;
+    compress_default_opts(&opts);
+    yaz0_params_t *params = &opts.yaz0;
+    const char *cache_dir = NULL;
+    const char *reuse_path = NULL;
+    int cache_mib = CACHE_MIB_DEFAULT;
+    int jobs = 1;
+    int max_memory_mib = 0;
+    int stream = 0;
+    const char *stats_path = NULL;
+    int verify = 0;
+    int threads_set = 0;
+    const char *source_path = NULL;
 
     for (int i = 1; i < argc; i++) {
         const char *arg = argv[i];
@@ -187,6 +109,59 @@ int main(int argc, char **argv) {
             do_decompress = 1;
         } else if (strcmp(arg, "--batch") == 0) {
             batch_mode = 1;
+        } else if (strcmp(arg, "--level") == 0) {
+            if (++i >= argc) die("--level requires a value");
+            params->level = atoi(argv[i]);
+            if (params->level < YAZ0_LEVEL_GREEDY || params->level > YAZ0_LEVEL_OPTIMAL)
+                die("--level must be 1, 2 or 3");
+        } else if (strcmp(arg, "--engine") == 0) {
+            if (++i >= argc) die("--engine requires a value");
+            if (strcmp(argv[i], "hc") == 0)
+                params->engine = YAZ0_ENGINE_HASHCHAIN;
+            else if (strcmp(argv[i], "bt") == 0)
+                params->engine = YAZ0_ENGINE_BINTREE;
+            else
+                die("--engine must be hc or bt");
+        } else if (strcmp(arg, "--threads") == 0) {
+            if (++i >= argc) die("--threads requires a value");
+            params->threads = atoi(argv[i]);
+            if (params->threads < 0) die("--threads must not be negative");
+            threads_set = 1;
+        } else if (strcmp(arg, "--split") == 0) {
+            if (++i >= argc) die("--split requires a value");
+            int kib = atoi(argv[i]);
+            if (kib <= 0) die("--split must be a positive size in KiB");
+            params->split_size = (size_t)kib * 1024;
+        } else if (strcmp(arg, "--cache-dir") == 0) {
+            if (++i >= argc) die("--cache-dir requires a value");
+            cache_dir = argv[i];
+        } else if (strcmp(arg, "--share-dups") == 0) {
+            opts.share_dups = 1;
+        } else if (strcmp(arg, "--stream") == 0) {
+            stream = 1;
+        } else if (strcmp(arg, "--verify") == 0) {
+            verify = 1;
+        } else if (strcmp(arg, "--source") == 0) {
+            if (++i >= argc) die("--source requires a value");
+            source_path = argv[i];
+        } else if (strcmp(arg, "--stats") == 0) {
+            if (++i >= argc) die("--stats requires a value");
+            stats_path = argv[i];
+        } else if (strcmp(arg, "--reuse") == 0) {
+            if (++i >= argc) die("--reuse requires a value");
+            reuse_path = argv[i];
+        } else if (strcmp(arg, "--cache-size") == 0) {
+            if (++i >= argc) die("--cache-size requires a value");
+            cache_mib = atoi(argv[i]);
+            if (cache_mib <= 0) die("--cache-size must be a positive size in MiB");
+        } else if (strcmp(arg, "--jobs") == 0) {
+            if (++i >= argc) die("--jobs requires a value");
+            jobs = atoi(argv[i]);
+            if (jobs < 0) die("--jobs must not be negative");
+        } else if (strcmp(arg, "--max-memory") == 0) {
+            if (++i >= argc) die("--max-memory requires a value");
+            max_memory_mib = atoi(argv[i]);
+            if (max_memory_mib <= 0) die("--max-memory must be a positive size in MiB");
         } else {
             fprintf(stderr, "error: unknown argument '%s'\n", arg); exit(1);
         }
@@ -194,13 +169,74 @@ int main(int argc, char **argv) {
 
     if (do_compress && do_decompress)
         die("cannot use --compress and --decompress together");
+    if (stats_path && !do_compress)
+        die("--stats only works with --compress");
+    opts.stats = (stats_path != NULL);
+    if (verify && do_decompress)
+        die("--verify works with --compress, --batch or on its own");
+    if (source_path && (do_compress || batch_mode))
+        die("--source is for --verify on its own; --compress compares with --in");
+
+    if (cache_dir && (batch_mode || do_compress)) {
+        opts.cache = cache_open(cache_dir, (uint64_t)cache_mib * 0x100000);
+        if (!opts.cache) {
+            fprintf(stderr, "error: cannot use cache directory '%s'\n", cache_dir);
+            exit(1);
+        }
+    }
+
+    mapped_file_t reuse_rom;
+    memset(&reuse_rom, 0, sizeof(reuse_rom));
+    if (reuse_path && (batch_mode || do_compress)) {
+        if (!map_file_read(&reuse_rom, reuse_path)) {
+            fprintf(stderr, "error: cannot open '%s'\n", reuse_path);
+            exit(1);
+        }
+        int err = reuse_open(reuse_rom.data, reuse_rom.size, &opts.reuse);
+        if (err != YED_OK) {
+            fprintf(stderr, "error: '%s': %s\n", reuse_path, yed_strerror(err));
+            exit(1);
+        }
+        reuse_stats_t rs;
+        reuse_get_stats(opts.reuse, &rs);
+        fprintf(stderr, "reuse: %s, %d compressed files indexed\n",
+                rs.rom_name, rs.indexed);
+    }
+
+    /* Verifying is cheap next to compressing, so unless told otherwise
+     * it uses every CPU rather than the encoder's default of one */
+    int verify_threads = threads_set ? params->threads : 0;
 
     if (batch_mode) {
-        return do_batch(in_path, out_path);
+        int ret = batch_compress(in_path, out_path, MB_DEFAULT, &opts, jobs,
+                                 (uint64_t)max_memory_mib * 0x100000,
+                                 verify, verify_threads);
+        close_blob_sources(&opts, &reuse_rom);
+        return ret;
+    }
+
+    if (verify && !do_compress) {
+        /* === Standalone verification === */
+        if (!in_path) die("no --in arg provided");
+        mapped_file_t comp, source;
+        memset(&source, 0, sizeof(source));
+        if (!map_file_read(&comp, in_path)) {
+            fprintf(stderr, "error: cannot open '%s'\n", in_path);
+            exit(1);
+        }
+        if (source_path && !map_file_read(&source, source_path)) {
+            fprintf(stderr, "error: cannot open '%s'\n", source_path);
+            exit(1);
+        }
+        int err = verify_rom(comp.data, comp.size, source.data, source.size,
+                             verify_threads, 0);
+        map_file_close(&source, 0, 0);
+        map_file_close(&comp, 0, 0);
+        return (err == YED_OK) ? 0 : 1;
     }
 
     if (!do_compress && !do_decompress)
-        die("must specify --compress or --decompress");
+        die("must specify --compress, --decompress or --verify");
 
     if (!in_path)  die("no --in arg provided");
     if (!out_path) die("no --out arg provided");
@@ -209,38 +245,34 @@ int main(int argc, char **argv) {
 
     /* Load ROM */
     fprintf(stderr, "loading '%s'...\n", in_path);
-    long rom_len = 0;
-    uint8_t *rom_data = load_file(in_path, &rom_len);
-    if (!rom_data) {
+    mapped_file_t in;
+    if (!map_file_read(&in, in_path)) {
         fprintf(stderr, "error: cannot open '%s'\n", in_path);
         exit(1);
     }
-    fprintf(stderr, "ROM size: %ld bytes (%.1f MiB)\n", rom_len, (double)rom_len/(1024*1024));
+    const uint8_t *rom_data = in.data;
+    size_t rom_len = in.size;
+    fprintf(stderr, "ROM size: %zu bytes (%.1f MiB)\n", rom_len, (double)rom_len/(1024*1024));
 
     if (do_decompress) {
         /* === Decompress mode === */
         fprintf(stderr, "mode: decompress\n");
 
         size_t out_rom_size;
-        uint8_t *out_rom = do_decompress_rom(rom_data, (size_t)rom_len, &out_rom_size);
-        free(rom_data);
+        if (!decompress_rom_to_file(rom_data, rom_len, params->threads,
+                                    out_path, &out_rom_size))
+            exit(1);
+        map_file_close(&in, 0, 0);
 
         fprintf(stderr, "decompressed ROM size: %zu bytes (%.1f MiB)\n",
                 out_rom_size, (double)out_rom_size/(1024*1024));
-
-        if (!write_file(out_path, out_rom, out_rom_size)) {
-            fprintf(stderr, "error: cannot write '%s'\n", out_path);
-            free(out_rom);
-            exit(1);
-        }
-        free(out_rom);
         fprintf(stderr, "decompressed ROM written to '%s'\n", out_path);
     } else {
         /* === Compress mode === */
         fprintf(stderr, "mode: compress\n");
 
         /* Auto-detect ROM version */
-        const rom_version_t *detected = detect_rom_version(rom_data, (size_t)rom_len);
+        const rom_version_t *detected = detect_rom_version(rom_data, rom_len);
         if (!detected) {
             fprintf(stderr,
                 "error: could not identify ROM version.\n"
@@ -257,28 +289,49 @@ int main(int argc, char **argv) {
         int dma_count = detected->dma_count;
 
         fprintf(stderr, "DMA table: 0x%X, %d entries\n", dma_offset, dma_count);
-        parse_dma_table(rom_data, dma_offset, dma_count);
-        validate_dma((size_t)rom_len);
+        dma_table_t dma;
+        int err = parse_dma_table(&dma, rom_data, rom_len, dma_offset, dma_count);
+        if (err == YED_OK) err = validate_dma(&dma, rom_len);
+        if (err != YED_OK) die(yed_strerror(err));
 
-        apply_rom_config(detected);
+        apply_rom_config(&dma, detected);
 
         int comp_count = 0;
-        for (int i = 0; i < num_entries; i++)
-            if (entries[i].compress) comp_count++;
+        for (int i = 0; i < dma.num_entries; i++)
+            if (dma.entries[i].compress) comp_count++;
         fprintf(stderr, "files to compress: %d\n", comp_count);
 
         size_t out_rom_size;
-        uint8_t *out_rom = compress_rom(rom_data, MB_DEFAULT, dma_offset, dma_count,
-                                         &out_rom_size);
-        free(rom_data);
-        fprintf(stderr, "ROM compressed successfully!\n");
-
-        if (!write_file(out_path, out_rom, out_rom_size)) {
-            fprintf(stderr, "error: cannot write '%s'\n", out_path);
-            free(out_rom);
-            exit(1);
+        int ok;
+        if (stream)
+            ok = compress_rom_to_file(rom_data, MB_DEFAULT, &dma, &opts,
+                                      out_path, &out_rom_size);
+        else
+            ok = compress_rom_mapped(rom_data, MB_DEFAULT, &dma, &opts,
+                                     out_path, &out_rom_size);
+        if (!ok) exit(1);
+        if (verify) {
+            mapped_file_t written;
+            if (!map_file_read(&written, out_path)) {
+                fprintf(stderr, "error: cannot open '%s'\n", out_path);
+                exit(1);
+            }
+            int err = verify_rom(written.data, written.size, rom_data, rom_len,
+                                 verify_threads, 0);
+            map_file_close(&written, 0, 0);
+            if (err != YED_OK) exit(1);
         }
-        free(out_rom);
+        if (stats_path) {
+            if (!write_stats(stats_path, &dma, rom_data)) {
+                fprintf(stderr, "error: cannot write '%s'\n", stats_path);
+                exit(1);
+            }
+            fprintf(stderr, "statistics written to '%s'\n", stats_path);
+        }
+        free_dma_table(&dma);
+        map_file_close(&in, 0, 0);
+        close_blob_sources(&opts, &reuse_rom);
+        fprintf(stderr, "ROM compressed successfully!\n");
         fprintf(stderr, "compressed ROM written to '%s'\n", out_path);
     }
 
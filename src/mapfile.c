@@ -0,0 +1,170 @@
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE  /* ftruncate, mmap */
+#endif
+
+#include "mapfile.h"
+#include "util.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static char *copy_path(const char *path) {
+    char *p = (char *)malloc(strlen(path) + 1);
+    if (p) strcpy(p, path);
+    return p;
+}
+
+int map_file_read(mapped_file_t *m, const char *path) {
+    memset(m, 0, sizeof(*m));
+    m->fd = -1;
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            close(fd);
+            m->data = (uint8_t *)p;
+            m->size = (size_t)st.st_size;
+            m->mapped = 1;
+            return 1;
+        }
+    }
+    close(fd);
+#endif
+    long len = 0;
+    m->data = load_file(path, &len);
+    if (!m->data) return 0;
+    m->size = (size_t)len;
+    return 1;
+}
+
+char *temp_path_for(const char *path) {
+    size_t cap = strlen(path) + 32;
+    char *tmp = (char *)malloc(cap);
+    if (tmp) snprintf(tmp, cap, "%s.tmp%ld", path, (long)getpid());
+    return tmp;
+}
+
+int rename_over(const char *tmp, const char *path) {
+#ifdef _WIN32
+    return MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(tmp, path) == 0;
+#endif
+}
+
+/* Release an output's temporary name along with the rest */
+static void free_paths(mapped_file_t *m) {
+    free(m->path);
+    free(m->tmp);
+    m->path = m->tmp = NULL;
+}
+
+int map_file_create(mapped_file_t *m, const char *path, size_t size) {
+    memset(m, 0, sizeof(*m));
+    m->fd = -1;
+    m->writable = 1;
+    m->size = size;
+    m->path = copy_path(path);
+    m->tmp = temp_path_for(path);
+    if (!m->path || !m->tmp) {
+        free_paths(m);
+        return 0;
+    }
+#ifndef _WIN32
+    int fd = open(m->tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        free_paths(m);
+        return 0;
+    }
+    if (size > 0 && ftruncate(fd, (off_t)size) == 0) {
+        void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED) {
+            m->data = (uint8_t *)p;
+            m->mapped = 1;
+            m->fd = fd;
+            return 1;
+        }
+    }
+    close(fd);
+#endif
+    m->data = (uint8_t *)calloc(size ? size : 1, 1);
+    if (!m->data) {
+        remove(m->tmp);
+        free_paths(m);
+        return 0;
+    }
+    return 1;
+}
+
+/* Fallback output: write the kept bytes, then zeros up to size */
+static int write_heap_output(mapped_file_t *m, size_t keep, size_t size) {
+    FILE *f = fopen(m->tmp, "wb");
+    if (!f) return 0;
+    int ok = fwrite(m->data, 1, keep, f) == keep;
+    static const uint8_t zeros[0x10000];
+    for (size_t pos = keep; ok && pos < size; ) {
+        size_t n = size - pos;
+        if (n > sizeof(zeros)) n = sizeof(zeros);
+        ok = fwrite(zeros, 1, n, f) == n;
+        pos += n;
+    }
+    if (fclose(f) != 0) ok = 0;
+    return ok;
+}
+
+int map_file_close(mapped_file_t *m, size_t keep, size_t size) {
+    int ok = 1;
+    if (keep > size) keep = size;
+    if (keep > m->size) keep = m->size;
+
+    if (!m->mapped) {
+        if (m->writable) ok = write_heap_output(m, keep, size);
+        free(m->data);
+    }
+#ifndef _WIN32
+    else {
+        munmap(m->data, m->size);
+        if (m->writable) {
+            /* Cutting back to keep drops the rest; growing again leaves a hole */
+            ok = ftruncate(m->fd, (off_t)keep) == 0 &&
+                 ftruncate(m->fd, (off_t)size) == 0;
+            if (close(m->fd) != 0) ok = 0;
+        }
+    }
+#endif
+    if (m->writable) {
+        if (ok) ok = rename_over(m->tmp, m->path);
+        if (!ok) remove(m->tmp);
+    }
+    free_paths(m);
+    memset(m, 0, sizeof(*m));
+    m->fd = -1;
+    return ok;
+}
+
+void map_file_abort(mapped_file_t *m) {
+    if (!m->mapped) {
+        free(m->data);
+    }
+#ifndef _WIN32
+    else {
+        munmap(m->data, m->size);
+        if (m->fd >= 0) close(m->fd);
+    }
+#endif
+    if (m->writable) remove(m->tmp);
+    free_paths(m);
+    memset(m, 0, sizeof(*m));
+    m->fd = -1;
+}
\ No newline at end of file
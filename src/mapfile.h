@@ -0,0 +1,54 @@
+#ifndef MAPFILE_H
+#define MAPFILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Whole-file I/O through memory mappings. Inputs are mapped read-only and
+ * outputs are created at their final size with ftruncate and mapped
+ * read-write, so zero bytes the caller never touches are never written
+ * and stay sparse. Where mapping is not available (Windows, or a file
+ * that cannot be mapped) the data goes through a heap buffer and plain
+ * reads and writes instead.
+ *
+ * An output is built under a temporary name next to its path and only
+ * renamed over it once complete. A mapped input that is also the output,
+ * under whatever spelling, keeps its contents until it is unmapped, and
+ * a failed run leaves the old file in place.
+ */
+typedef struct {
+    uint8_t *data;
+    size_t   size;
+    int      mapped;     /* 0 = data is a heap copy */
+    int      writable;
+    int      fd;
+    char    *path;       /* output path */
+    char    *tmp;        /* where the output is written until it is closed */
+} mapped_file_t;
+
+/* Map path read-only. Returns 0 if it cannot be read. */
+int map_file_read(mapped_file_t *m, const char *path);
+
+/* Create (or replace) path as size zero bytes and map it read-write.
+ * Returns 0 if it cannot be created or, without a mapping, if out of
+ * memory. */
+int map_file_create(mapped_file_t *m, const char *path, size_t size);
+
+/*
+ * Unmap. For an output, the file ends up size bytes long: bytes from
+ * keep on are discarded and read back as zeros, without being written.
+ * Returns 0 if the output could not be written, in which case path is
+ * left as it was. Inputs ignore keep and size.
+ */
+int map_file_close(mapped_file_t *m, size_t keep, size_t size);
+
+/* Unmap an output and throw it away, leaving path as it was */
+void map_file_abort(mapped_file_t *m);
+
+/* A new temporary name next to path (free it), and moving it over path
+ * (0 on failure), for outputs written without a mapping */
+char *temp_path_for(const char *path);
+int   rename_over(const char *tmp, const char *path);
+
+#endif /* MAPFILE_H */
\ No newline at end of file
@@ -0,0 +1,318 @@
+#include "match.h"
+#include "util.h"
+#include "thread.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MATCH_X86 1
+#include <immintrin.h>
+#endif
+
+#define HASH_BITS  14
+#define HASH_SIZE  (1 << HASH_BITS)
+#define RING_MASK  (YAZ0_WINDOW - 1)
+
+/* Tree nodes must outlive the window by one position */
+#define BT_NODES   (YAZ0_WINDOW * 2)
+#define BT_MASK    (BT_NODES - 1)
+
+static uint32_t hash3(const uint8_t *p) {
+    uint32_t v = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* --- Match length kernels --- */
+
+/*
+ * Each kernel returns the first index in [len, limit) where a and b
+ * differ, or limit. The caller guarantees limit bytes are readable from
+ * both pointers.
+ */
+typedef int (*match_len_fn)(const uint8_t *a, const uint8_t *b,
+                            int len, int limit);
+
+/* Index of the lowest differing byte in a non-zero XOR of two words */
+static int diff_byte(uint64_t x) {
+#if defined(__GNUC__)
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return __builtin_clzll(x) >> 3;
+#else
+    return __builtin_ctzll(x) >> 3;
+#endif
+#else
+    uint8_t b[8];
+    int i = 0;
+    memcpy(b, &x, 8);
+    while (b[i] == 0) i++;
+    return i;
+#endif
+}
+
+static int match_len_tail(const uint8_t *a, const uint8_t *b,
+                          int len, int limit) {
+    while (len + 8 <= limit) {
+        uint64_t x, y;
+        memcpy(&x, a + len, 8);
+        memcpy(&y, b + len, 8);
+        if (x != y) return len + diff_byte(x ^ y);
+        len += 8;
+    }
+    while (len < limit && a[len] == b[len])
+        len++;
+    return len;
+}
+
+/* Portable: 64-bit XOR, then count trailing zero bytes */
+static int match_len_word(const uint8_t *a, const uint8_t *b,
+                          int len, int limit) {
+    return match_len_tail(a, b, len, limit);
+}
+
+#ifdef MATCH_X86
+/*
+ * Most candidates differ within a few bytes, so the vector kernels look at
+ * one word first and only then switch to wide compares.
+ */
+__attribute__((target("sse2")))
+static int match_len_sse2(const uint8_t *a, const uint8_t *b,
+                          int len, int limit) {
+    if (len + 8 <= limit) {
+        uint64_t x, y;
+        memcpy(&x, a + len, 8);
+        memcpy(&y, b + len, 8);
+        if (x != y) return len + diff_byte(x ^ y);
+        len += 8;
+    }
+    while (len + 16 <= limit) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + len));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + len));
+        unsigned eq = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+        if (eq != 0xFFFFu) return len + __builtin_ctz(~eq);
+        len += 16;
+    }
+    return match_len_tail(a, b, len, limit);
+}
+
+__attribute__((target("avx2")))
+static int match_len_avx2(const uint8_t *a, const uint8_t *b,
+                          int len, int limit) {
+    if (len + 8 <= limit) {
+        uint64_t x, y;
+        memcpy(&x, a + len, 8);
+        memcpy(&y, b + len, 8);
+        if (x != y) return len + diff_byte(x ^ y);
+        len += 8;
+    }
+    while (len + 32 <= limit) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + len));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(b + len));
+        unsigned eq = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+        if (eq != 0xFFFFFFFFu) return len + __builtin_ctz(~eq);
+        len += 32;
+    }
+    return match_len_sse2(a, b, len, limit);
+}
+#endif
+
+static match_len_fn match_len = match_len_word;
+
+/* Pick the widest kernel the CPU supports. Runs once, before the first
+ * match finder exists, since workers set theirs up concurrently. */
+static once_t match_len_once = THREAD_ONCE_INIT;
+
+static void select_match_len(void) {
+#ifdef MATCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        match_len = match_len_avx2;
+    else if (__builtin_cpu_supports("sse2"))
+        match_len = match_len_sse2;
+#endif
+}
+
+int mf_init(matchfinder_t *mf, int engine) {
+    thread_once(&match_len_once, select_match_len);
+
+    mf->engine = engine;
+    mf->head = (int32_t *)malloc(HASH_SIZE * sizeof(int32_t));
+    mf->tail = NULL;
+    mf->next = NULL;
+    mf->son  = NULL;
+    if (engine == YAZ0_ENGINE_BINTREE) {
+        mf->son = (int32_t *)malloc(BT_NODES * 2 * sizeof(int32_t));
+    } else {
+        mf->tail = (int32_t *)malloc(HASH_SIZE * sizeof(int32_t));
+        mf->next = (int32_t *)malloc(YAZ0_WINDOW * sizeof(int32_t));
+    }
+    mf->data = NULL;
+    mf->size = 0;
+    mf->max_chain = 0;
+    if (!mf->head || (!mf->son && (!mf->tail || !mf->next))) {
+        mf_free(mf);
+        return 0;
+    }
+    return 1;
+}
+
+void mf_free(matchfinder_t *mf) {
+    free(mf->head);
+    free(mf->tail);
+    free(mf->next);
+    free(mf->son);
+    mf->head = mf->tail = mf->next = mf->son = NULL;
+}
+
+void mf_reset(matchfinder_t *mf, const uint8_t *data, int size, int start) {
+    mf->data = data;
+    mf->size = size;
+    mf->base = start;
+    mf->pos  = start;
+    memset(mf->head, 0xFF, HASH_SIZE * sizeof(int32_t));
+}
+
+/* --- Hash chains --- */
+
+static void hc_insert(matchfinder_t *mf, int p) {
+    const uint8_t *data = mf->data;
+
+    /* Position p reuses the ring slot of p - WINDOW, which is now too far
+     * back to be referenced. It is always the oldest entry of its chain. */
+    int old = p - YAZ0_WINDOW;
+    if (old >= mf->base) {
+        uint32_t oh = hash3(data + old);
+        if (mf->head[oh] == old) {
+            int32_t nx = mf->next[old & RING_MASK];
+            mf->head[oh] = nx;
+        }
+    }
+
+    uint32_t h = hash3(data + p);
+    mf->next[p & RING_MASK] = -1;
+    if (mf->head[h] < 0)
+        mf->head[h] = p;
+    else
+        mf->next[mf->tail[h] & RING_MASK] = p;
+    mf->tail[h] = p;
+}
+
+static int hc_find(matchfinder_t *mf, int pos, int limit, int *out_hitp) {
+    /* Bring the chains up to date: every position before pos is a candidate.
+     * The last two bytes of the buffer cannot start a 3-byte prefix. */
+    int ins_end = (pos < mf->size - 2) ? pos : mf->size - 2;
+    while (mf->pos < ins_end)
+        hc_insert(mf, mf->pos++);
+    if (mf->pos < pos) mf->pos = pos;
+
+    if (limit < YAZ0_MIN_MATCH) return 0;
+
+    const uint8_t *data = mf->data;
+    const uint8_t *cur = data + pos;
+    int best = YAZ0_MIN_MATCH - 1;
+    int hitp = 0;
+    int budget = mf->max_chain ? mf->max_chain : -1;
+
+    for (int32_t q = mf->head[hash3(cur)]; q >= 0 && budget != 0;
+         q = mf->next[q & RING_MASK], budget--) {
+        const uint8_t *cand = data + q;
+        /* A longer match must also agree on byte [best] */
+        if (cand[best] != cur[best]) continue;
+        int len = match_len(cand, cur, 0, limit);
+        if (len > best) {
+            best = len;
+            hitp = q;
+            if (best == limit) break;
+        }
+    }
+    if (best < YAZ0_MIN_MATCH) return 0;
+    *out_hitp = hitp;
+    return best;
+}
+
+/* --- Binary tree --- */
+
+/*
+ * Insert p into its bucket's tree and return the longest match met on the
+ * way. Suffixes are ordered by their first lim bytes; a node that matches
+ * all of them is replaced by p, taking over its children.
+ */
+static int bt_insert(matchfinder_t *mf, int p, int *out_hitp) {
+    const uint8_t *cur = mf->data + p;
+    int lim = mf->size - p;
+    if (lim > YAZ0_MAX_MATCH) lim = YAZ0_MAX_MATCH;
+
+    uint32_t h = hash3(cur);
+    int32_t q = mf->head[h];
+    mf->head[h] = p;
+
+    int32_t *ptr0 = &mf->son[(p & BT_MASK) * 2 + 1];  /* right child */
+    int32_t *ptr1 = &mf->son[(p & BT_MASK) * 2];      /* left child */
+    int len0 = 0, len1 = 0;
+    int best = YAZ0_MIN_MATCH - 1;
+
+    for (;;) {
+        if (q < 0 || p - q > YAZ0_WINDOW) {
+            *ptr0 = *ptr1 = -1;
+            break;
+        }
+        int32_t *pair = &mf->son[(q & BT_MASK) * 2];
+        const uint8_t *cand = mf->data + q;
+        int len = match_len(cand, cur, (len0 < len1) ? len0 : len1, lim);
+        if (len > best) {
+            best = len;
+            *out_hitp = q;
+        }
+        if (len == lim) {
+            *ptr1 = pair[0];
+            *ptr0 = pair[1];
+            break;
+        }
+        if (cand[len] < cur[len]) {
+            *ptr1 = q;
+            ptr1 = pair + 1;
+            q = *ptr1;
+            len1 = len;
+        } else {
+            *ptr0 = q;
+            ptr0 = pair;
+            q = *ptr0;
+            len0 = len;
+        }
+    }
+    return (best >= YAZ0_MIN_MATCH) ? best : 0;
+}
+
+/* Returns the untruncated match length; pos itself is inserted too */
+static int bt_find(matchfinder_t *mf, int pos, int *out_hitp) {
+    int dummy;
+    int ins_end = (pos < mf->size - 2) ? pos : mf->size - 2;
+    while (mf->pos < ins_end)
+        bt_insert(mf, mf->pos++, &dummy);
+
+    if (pos >= mf->size - 2) {
+        if (mf->pos < pos) mf->pos = pos;
+        return 0;
+    }
+    mf->pos = pos + 1;
+    return bt_insert(mf, pos, out_hitp);
+}
+
+/* --- Public API --- */
+
+int mf_find(matchfinder_t *mf, int pos, int limit, int *out_hitp) {
+    int hitp = 0;
+    int hitl;
+
+    if (mf->engine == YAZ0_ENGINE_BINTREE) {
+        /* The tree search inserts pos, so it always runs to full length */
+        hitl = bt_find(mf, pos, &hitp);
+        if (hitl > limit) hitl = limit;
+    } else {
+        hitl = hc_find(mf, pos, limit, &hitp);
+    }
+
+    if (hitl < YAZ0_MIN_MATCH) {
+        hitl = 0;
+        hitp = 0;
+    }
+    *out_hitp = hitp;
+    return hitl;
+}
@@ -0,0 +1,68 @@
+#ifndef MATCH_H
+#define MATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "yaz0.h"
+
+/* Yaz0 format limits */
+#define YAZ0_WINDOW     0x1000  /* maximum match distance */
+#define YAZ0_MIN_MATCH  3
+#define YAZ0_MAX_MATCH  0x111
+
+/*
+ * Match finder. Positions are inserted in increasing order; two engines
+ * are available (see YAZ0_ENGINE_* in yaz0.h).
+ *
+ * Hash chains: each 3-byte prefix hashes to a bucket that links its
+ * positions from oldest to newest, so a search can walk the window front
+ * to back and stop as soon as the length limit is reached. Links live in a
+ * ring of YAZ0_WINDOW slots: a position is dropped from its chain when the
+ * slot is reused, i.e. exactly when it leaves the window.
+ *
+ * Binary tree: each bucket roots a binary search tree of the suffixes in
+ * the window, newest at the root. Inserting a position walks one root to
+ * leaf path, which visits the longest match on the way, so every position
+ * costs a logarithmic number of comparisons however repetitive the data.
+ * Nodes that fall out of the window are cut off as they are reached.
+ */
+typedef struct {
+    int      engine;     /* YAZ0_ENGINE_* */
+    const uint8_t *data;
+    int      size;       /* bytes readable from data */
+    int      base;       /* first position fed to the finder */
+    int      pos;        /* next position to insert */
+    int32_t *head;       /* per bucket: oldest live position (hash chains)
+                            or tree root (binary tree), -1 if empty */
+    int32_t *tail;       /* newest live position per bucket */
+    int32_t *next;       /* forward links, indexed by pos & (YAZ0_WINDOW-1) */
+    int32_t *son;        /* tree children, two per node */
+    int      max_chain;  /* hash chain candidates per search, 0 = all */
+} matchfinder_t;
+
+/* Allocate the finder tables for the given engine; 0 if out of memory */
+int  mf_init(matchfinder_t *mf, int engine);
+void mf_free(matchfinder_t *mf);
+
+/*
+ * Prepare to search data[0..size). Positions before start are never
+ * referenced; the first search must be at or after start.
+ */
+void mf_reset(matchfinder_t *mf, const uint8_t *data, int size, int start);
+
+/*
+ * Find the longest match for data[pos..] within the window, at most
+ * limit bytes long. Among equally long matches the hash chains return the
+ * earliest one; the tree returns whichever its search path meets first.
+ * Returns the match length (0 if shorter than YAZ0_MIN_MATCH) and stores
+ * its source position in *out_hitp. Searches must be made in
+ * increasing pos order.
+ *
+ * Yaz0 matches cost the same at any distance, and every shorter length is
+ * available at the same source position, so the longest match describes
+ * all the matches a parser can choose from at pos.
+ */
+int mf_find(matchfinder_t *mf, int pos, int limit, int *out_hitp);
+
+#endif /* MATCH_H */
@@ -1,5 +1,6 @@
 #include "n64crc.h"
 #include "util.h"
+#include "crc32.h"
 
 #define N64_HEADER_SIZE  0x40
 #define N64_BC_SIZE      (0x1000 - N64_HEADER_SIZE)
@@ -12,32 +13,8 @@
 #define CHECKSUM_CIC6105 0xDF26F436u
 #define CHECKSUM_CIC6106 0x1FEA617Au
 
-static uint32_t crc_table[256];
-static int crc_table_ready = 0;
-
-static void n64_gen_table(void) {
-    if (crc_table_ready) return;
-    uint32_t poly = 0xEDB88320u;
-    for (int i = 0; i < 256; i++) {
-        uint32_t crc = (uint32_t)i;
-        for (int j = 0; j < 8; j++) {
-            if (crc & 1) crc = (crc >> 1) ^ poly;
-            else         crc = crc >> 1;
-        }
-        crc_table[i] = crc;
-    }
-    crc_table_ready = 1;
-}
-
-static uint32_t n64_crc32(const uint8_t *data, size_t offset, size_t length) {
-    uint32_t crc = 0xFFFFFFFFu;
-    for (size_t i = 0; i < length; i++)
-        crc = (crc >> 8) ^ crc_table[(crc ^ data[offset + i]) & 0xFF];
-    return crc ^ 0xFFFFFFFFu;
-}
-
 static int n64_get_cic(const uint8_t *data) {
-    uint32_t crc = n64_crc32(data, N64_HEADER_SIZE, N64_BC_SIZE);
+    uint32_t crc = crc32_calc(data + N64_HEADER_SIZE, N64_BC_SIZE);
     switch (crc) {
         case 0x6170A4A1u: return 6101;
         case 0x90BB6CB5u: return 6102;
@@ -49,30 +26,30 @@ static int n64_get_cic(const uint8_t *data) {
 }
 
 static uint32_t rol32(uint32_t value, int bits) {
-    return (value << bits) | (value >> (32 - bits));
+    return (value << bits) | (value >> ((32 - bits) & 31));
 }
 
-void n64crc(uint8_t *rom) {
-    n64_gen_table();
-    int bootcode = n64_get_cic(rom);
-    if (bootcode == 0) {
-        fprintf(stderr, "warning: unknown CIC chip, CRC not updated\n");
-        return;
-    }
-
-    uint32_t seed;
-    switch (bootcode) {
-        case 6101: case 6102: seed = CHECKSUM_CIC6102; break;
-        case 6103: seed = CHECKSUM_CIC6103; break;
-        case 6105: seed = CHECKSUM_CIC6105; break;
-        case 6106: seed = CHECKSUM_CIC6106; break;
-        default: return;
-    }
+static uint32_t load32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
 
+/*
+ * The checksum proper over the CHECKSUM_LENGTH bytes after the boot code.
+ * Both calls pass a constant cic6105, so the compiler builds one loop per
+ * variant instead of testing the boot code on every word. The 6105
+ * variant mixes in 64 words of the boot code, read once up front.
+ */
+static void checksum_words(const uint8_t *rom, uint32_t seed, int cic6105,
+                           uint32_t t[6]) {
     uint32_t t1=seed, t2=seed, t3=seed, t4=seed, t5=seed, t6=seed;
+    uint32_t key[64];
+    if (cic6105)
+        for (int k = 0; k < 64; k++)
+            key[k] = load32(rom + N64_HEADER_SIZE + 0x0710 + 4 * k);
 
-    for (size_t i = CHECKSUM_START; i < CHECKSUM_START + CHECKSUM_LENGTH; i += 4) {
-        uint32_t d = get32(rom, i);
+    const uint8_t *p = rom + CHECKSUM_START;
+    for (size_t i = 0; i < CHECKSUM_LENGTH / 4; i++, p += 4) {
+        uint32_t d = load32(p);
         if ((t6 + d) < t6) t4++;
         t6 += d;
         t3 ^= d;
@@ -80,11 +57,30 @@ void n64crc(uint8_t *rom) {
         t5 += r;
         if (t2 > d) t2 ^= r;
         else        t2 ^= t6 ^ d;
-        if (bootcode == 6105)
-            t1 += get32(rom, N64_HEADER_SIZE + 0x0710 + (i & 0xFF)) ^ d;
+        if (cic6105)
+            t1 += key[i & 63] ^ d;
         else
             t1 += t5 ^ d;
     }
+    t[0] = t1; t[1] = t2; t[2] = t3; t[3] = t4; t[4] = t5; t[5] = t6;
+}
+
+int n64crc(uint8_t *rom) {
+    int bootcode = n64_get_cic(rom);
+
+    uint32_t seed;
+    switch (bootcode) {
+        case 6101: case 6102: seed = CHECKSUM_CIC6102; break;
+        case 6103: seed = CHECKSUM_CIC6103; break;
+        case 6105: seed = CHECKSUM_CIC6105; break;
+        case 6106: seed = CHECKSUM_CIC6106; break;
+        default: return 0;
+    }
+
+    uint32_t t[6];
+    if (bootcode == 6105) checksum_words(rom, seed, 1, t);
+    else                  checksum_words(rom, seed, 0, t);
+    uint32_t t1 = t[0], t2 = t[1], t3 = t[2], t4 = t[3], t5 = t[4], t6 = t[5];
 
     uint32_t crc0, crc1;
     if (bootcode == 6103) {
@@ -96,4 +92,5 @@ void n64crc(uint8_t *rom) {
     }
     put32(rom, N64_CRC1_OFS, crc0);
     put32(rom, N64_CRC2_OFS, crc1);
+    return 1;
 }
\ No newline at end of file
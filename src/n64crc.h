@@ -3,10 +3,13 @@
 
 #include <stdint.h>
 
+/* n64crc reads and writes only the first N64CRC_SPAN bytes of a ROM */
+#define N64CRC_SPAN  0x101000
+
 /*
  * Recalculate and update the N64 ROM header CRC fields in-place.
- * Prints a warning to stderr if the CIC chip is unrecognized.
+ * Returns 0, leaving them unchanged, if the CIC chip is unrecognized.
  */
-void n64crc(uint8_t *rom);
+int n64crc(uint8_t *rom);
 
 #endif /* N64CRC_H */
@@ -0,0 +1,138 @@
+#include "reuse.h"
+#include "util.h"
+#include "dma.h"
+#include "romdb.h"
+#include "yaz0.h"
+#include "thread.h"
+#include "yaz0encdec.h"
+
+/* One compressed file of the old ROM */
+typedef struct {
+    uint64_t hash;      /* hash64 of the decoded contents */
+    uint32_t size;      /* decoded size */
+    uint32_t pstart, pend;
+} old_blob_t;
+
+struct reuse {
+    const uint8_t *rom;
+    const char    *rom_name;
+    old_blob_t    *blobs;   /* sorted by hash, then size */
+    int            nblobs;
+    mutex_t        lock;    /* guards the counters below */
+    int            hits, misses;
+};
+
+static int cmp_blob(const void *a, const void *b) {
+    const old_blob_t *x = (const old_blob_t *)a, *y = (const old_blob_t *)b;
+    if (x->hash != y->hash) return (x->hash < y->hash) ? -1 : 1;
+    if (x->size != y->size) return (x->size < y->size) ? -1 : 1;
+    return (x->pstart < y->pstart) ? -1 : (x->pstart > y->pstart);
+}
+
+int reuse_open(const uint8_t *rom, size_t rom_size, reuse_t **out) {
+    const rom_version_t *ver = detect_rom_version(rom, rom_size);
+    if (!ver) return YED_ERR_UNKNOWN_ROM;
+
+    reuse_t *r = (reuse_t *)calloc(1, sizeof(*r));
+    if (!r) return YED_ERR_NOMEM;
+    r->rom = rom;
+    r->rom_name = ver->name;
+    r->blobs = (old_blob_t *)malloc((size_t)(ver->dma_count + 1) * sizeof(old_blob_t));
+    if (!r->blobs) {
+        free(r);
+        return YED_ERR_NOMEM;
+    }
+
+    buf_t dec;
+    memset(&dec, 0, sizeof(dec));
+
+    for (int i = 0; i < ver->dma_count; i++) {
+        size_t eofs = ver->dma_offset + (size_t)i * 16;
+        if (eofs + 16 > rom_size) break;
+
+        uint32_t vstart = get32(rom, eofs);
+        uint32_t vend   = get32(rom, eofs + 4);
+        uint32_t pstart = get32(rom, eofs + 8);
+        uint32_t pend   = get32(rom, eofs + 12);
+
+        /* Only compressed files are worth reusing */
+        if (pstart == DMA_DELETED || pend == DMA_DELETED || pend == 0 ||
+            pend <= pstart || pend > rom_size || vend <= vstart)
+            continue;
+
+        /* Files that fail to decode are simply not offered */
+        size_t n;
+        if (!buf_try_reserve(&dec, vend - vstart)) {
+            buf_free(&dec);
+            free(r->blobs);
+            free(r);
+            return YED_ERR_NOMEM;
+        }
+        if (yaz0_decode_checked(rom + pstart, pend - pstart,
+                                dec.data, vend - vstart, &n) != YAZ0_OK)
+            continue;
+
+        old_blob_t *b = &r->blobs[r->nblobs++];
+        b->hash   = hash64(dec.data, n);
+        b->size   = (uint32_t)n;
+        b->pstart = pstart;
+        b->pend   = pend;
+    }
+    buf_free(&dec);
+
+    qsort(r->blobs, (size_t)r->nblobs, sizeof(old_blob_t), cmp_blob);
+    mutex_init(&r->lock);
+    *out = r;
+    return YED_OK;
+}
+
+void reuse_get_stats(reuse_t *r, reuse_stats_t *stats) {
+    mutex_lock(&r->lock);
+    stats->rom_name = r->rom_name;
+    stats->indexed = r->nblobs;
+    stats->reused = r->hits;
+    stats->not_found = r->misses;
+    mutex_unlock(&r->lock);
+}
+
+void reuse_close(reuse_t *r) {
+    if (!r) return;
+    mutex_destroy(&r->lock);
+    free(r->blobs);
+    free(r);
+}
+
+int reuse_get(reuse_t *r, const uint8_t *data, size_t size,
+              const uint8_t **blob, size_t *blob_size) {
+    uint64_t hash = hash64(data, size);
+
+    /* First candidate with this hash and size */
+    int lo = 0, hi = r->nblobs;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        const old_blob_t *b = &r->blobs[mid];
+        if (b->hash < hash || (b->hash == hash && b->size < size))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    int hit = 0;
+    for (; lo < r->nblobs && r->blobs[lo].hash == hash &&
+           r->blobs[lo].size == size; lo++) {
+        const old_blob_t *b = &r->blobs[lo];
+        size_t len = yaz0_decodes_to(r->rom + b->pstart, b->pend - b->pstart,
+                                     data, size);
+        if (len) {
+            *blob = r->rom + b->pstart;
+            *blob_size = len;
+            hit = 1;
+            break;
+        }
+    }
+
+    mutex_lock(&r->lock);
+    if (hit) r->hits++; else r->misses++;
+    mutex_unlock(&r->lock);
+    return hit;
+}
@@ -0,0 +1,43 @@
+#ifndef REUSE_H
+#define REUSE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Yaz0 blobs taken from a previously compressed ROM (an earlier build or
+ * a retail ROM). Every compressed DMA entry of the old ROM is decoded
+ * once and indexed by a hash of its contents, so a new file is matched
+ * wherever it lives in either ROM. A match is confirmed by decoding the
+ * old blob against the new file before it is handed out.
+ */
+typedef struct reuse reuse_t;
+
+/*
+ * Index the compressed ROM rom[0..rom_size) into *out. The buffer must
+ * stay valid until reuse_close. Returns YED_OK, YED_ERR_UNKNOWN_ROM if
+ * the ROM is not recognized, or YED_ERR_NOMEM.
+ */
+int reuse_open(const uint8_t *rom, size_t rom_size, reuse_t **out);
+
+/* What an index holds and how often it was used so far */
+typedef struct {
+    const char *rom_name;  /* version of the old ROM */
+    int         indexed;   /* compressed files offered for reuse */
+    int         reused, not_found;
+} reuse_stats_t;
+
+void reuse_get_stats(reuse_t *r, reuse_stats_t *stats);
+
+/* Free the index */
+void reuse_close(reuse_t *r);
+
+/*
+ * Find an old blob that decodes to data[0..size). On success points
+ * *blob into the old ROM, stores the length of its Yaz0 stream and
+ * returns 1. Thread-safe.
+ */
+int reuse_get(reuse_t *r, const uint8_t *data, size_t size,
+              const uint8_t **blob, size_t *blob_size);
+
+#endif /* REUSE_H */
@@ -135,10 +135,10 @@ const rom_version_t *detect_rom_version(const uint8_t *rom_data, size_t rom_size
     return NULL;
 }
 
-void apply_rom_config(const rom_version_t *ver) {
-    for (int i = 0; i < num_entries; i++)
-        entries[i].compress = 1;
+void apply_rom_config(dma_table_t *t, const rom_version_t *ver) {
+    for (int i = 0; i < t->num_entries; i++)
+        t->entries[i].compress = 1;
     for (const int *p = ver->skip_indices; *p >= 0; p++)
-        if (*p < num_entries)
-            entries[*p].compress = 0;
+        if (*p < t->num_entries)
+            t->entries[*p].compress = 0;
 }
\ No newline at end of file
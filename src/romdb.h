@@ -4,6 +4,8 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#include "dma.h"
+
 typedef struct {
     const char *name;
     const char *build_date;   /* ASCII, 17 chars */
@@ -27,8 +29,8 @@ const rom_version_t *detect_rom_version(const uint8_t *rom_data, size_t rom_size
 
 /*
  * Mark all DMA entries for compression, then un-mark the skip list
- * for the given ROM version. Operates on the global entries[] table.
+ * for the given ROM version.
  */
-void apply_rom_config(const rom_version_t *ver);
+void apply_rom_config(dma_table_t *t, const rom_version_t *ver);
 
 #endif /* ROMDB_H */
@@ -0,0 +1,163 @@
+#include "stats.h"
+#include "cli.h"
+#include "util.h"
+#include "crc32.h"
+
+static const char *const origin_names[] = { "none", "encoded", "cache", "reuse" };
+
+static size_t entry_size(const dma_entry_t *e) {
+    return e->end - e->start;
+}
+
+/* Bytes the entry takes in the ROM */
+static size_t rom_size(const dma_entry_t *e) {
+    return e->compress ? e->comp_sz : entry_size(e);
+}
+
+static const char *entry_status(const dma_entry_t *e) {
+    if (e->deleted) return "deleted";
+    if (e->start == e->end) return "empty";
+    if (e->dup_of >= 0) return "duplicate";
+    if (e->origin == BLOB_NONE) return "excluded";
+    return e->compress ? "compressed" : "stored";
+}
+
+static double ratio(size_t part, size_t whole) {
+    return whole ? (double)part / (double)whole : 0.0;
+}
+
+/* Sort comparator: longest encode first, ties in DMA order */
+static int cmp_slowest(const void *a, const void *b) {
+    const dma_entry_t *ea = *(const dma_entry_t *const *)a;
+    const dma_entry_t *eb = *(const dma_entry_t *const *)b;
+    if (ea->enc_ns != eb->enc_ns) return (ea->enc_ns < eb->enc_ns) ? 1 : -1;
+    return ea->index - eb->index;
+}
+
+/* Sort comparator: highest Yaz0 size / file size first, ties in DMA order */
+static int cmp_least_compressible(const void *a, const void *b) {
+    const dma_entry_t *ea = *(const dma_entry_t *const *)a;
+    const dma_entry_t *eb = *(const dma_entry_t *const *)b;
+    uint64_t ra = (uint64_t)ea->yaz0_sz * entry_size(eb);
+    uint64_t rb = (uint64_t)eb->yaz0_sz * entry_size(ea);
+    if (ra != rb) return (ra < rb) ? 1 : -1;
+    return ea->index - eb->index;
+}
+
+static void print_ranked(const char *title, const dma_entry_t *const *list, int n) {
+    fprintf(stderr, "%s:\n", title);
+    for (int i = 0; i < n; i++) {
+        const dma_entry_t *e = list[i];
+        fprintf(stderr, "  entry %4d: %9.3f ms, %8zu -> %8zu bytes (%5.1f%%), %s\n",
+                e->index, (double)e->enc_ns / 1e6, entry_size(e), e->yaz0_sz,
+                100.0 * ratio(e->yaz0_sz, entry_size(e)), entry_status(e));
+    }
+}
+
+static void json_indices(FILE *f, const char *key, const dma_entry_t *const *list, int n) {
+    fprintf(f, "    \"%s\": [", key);
+    for (int i = 0; i < n; i++)
+        fprintf(f, "%s%d", i ? ", " : "", list[i]->index);
+    fprintf(f, "]");
+}
+
+int write_stats(const char *path, const dma_table_t *dma, const uint8_t *rom_data) {
+    const dma_entry_t *entries = dma->entries;
+    int num_entries = dma->num_entries;
+
+    /* Entries that went through the encoder, cache or reuse index */
+    const dma_entry_t **slowest = (const dma_entry_t **)malloc(
+        (size_t)(num_entries + 1) * sizeof(*slowest));
+    const dma_entry_t **worst = (const dma_entry_t **)malloc(
+        (size_t)(num_entries + 1) * sizeof(*worst));
+    if (!slowest || !worst) die("out of memory");
+    int nranked = 0;
+    for (int i = 0; i < num_entries; i++) {
+        const dma_entry_t *e = &entries[i];
+        if (e->deleted || e->dup_of >= 0 || e->origin == BLOB_NONE) continue;
+        slowest[nranked] = worst[nranked] = e;
+        nranked++;
+    }
+    qsort(slowest, (size_t)nranked, sizeof(*slowest), cmp_slowest);
+    qsort(worst, (size_t)nranked, sizeof(*worst), cmp_least_compressible);
+    int ntop = (nranked < STATS_TOP) ? nranked : STATS_TOP;
+
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        free(slowest);
+        free(worst);
+        return 0;
+    }
+
+    size_t len = strlen(path);
+    int csv = len >= 4 && strcmp(path + len - 4, ".csv") == 0;
+    size_t total_size = 0, total_rom = 0;
+    uint64_t total_ns = 0;
+    int ncompressed = 0, nstored = 0;
+
+    if (csv)
+        fprintf(f, "index,vrom_start,vrom_end,size,rom_size,ratio,status,source,"
+                   "dup_of,crc32,yaz0_size,time_ms,literals,matches\n");
+    else
+        fprintf(f, "{\n  \"entries\": [\n");
+
+    for (int i = 0; i < num_entries; i++) {
+        const dma_entry_t *e = &entries[i];
+        size_t size = entry_size(e);
+        size_t rsz = e->deleted ? 0 : rom_size(e);
+        const char *status = entry_status(e);
+        const char *source = origin_names[e->origin];
+        double ms = (double)e->enc_ns / 1e6;
+        uint32_t crc = crc32_calc(rom_data + e->start, size);
+
+        if (!e->deleted && e->dup_of < 0) {
+            total_size += size;
+            total_rom += rsz;
+            total_ns += e->enc_ns;
+            if (e->origin != BLOB_NONE) {
+                if (e->compress) ncompressed++;
+                else nstored++;
+            }
+        }
+
+        if (csv) {
+            fprintf(f, "%d,%u,%u,%zu,%zu,%.4f,%s,%s,%d,%08X,%zu,%.3f,%u,%u\n",
+                    e->index, e->start, e->end, size, rsz, ratio(rsz, size),
+                    status, source, e->dup_of, crc, e->yaz0_sz, ms,
+                    e->literals, e->matches);
+        } else {
+            fprintf(f, "    {\"index\": %d, \"vrom_start\": %u, \"vrom_end\": %u, "
+                       "\"size\": %zu, \"rom_size\": %zu, \"ratio\": %.4f, "
+                       "\"status\": \"%s\", \"source\": \"%s\", \"dup_of\": %d, "
+                       "\"crc32\": \"%08X\", \"yaz0_size\": %zu, \"time_ms\": %.3f, "
+                       "\"literals\": %u, \"matches\": %u}%s\n",
+                    e->index, e->start, e->end, size, rsz, ratio(rsz, size),
+                    status, source, e->dup_of, crc, e->yaz0_sz, ms,
+                    e->literals, e->matches, (i + 1 < num_entries) ? "," : "");
+        }
+    }
+
+    if (!csv) {
+        fprintf(f, "  ],\n  \"summary\": {\n");
+        fprintf(f, "    \"compressed\": %d,\n    \"stored\": %d,\n", ncompressed, nstored);
+        fprintf(f, "    \"size\": %zu,\n    \"rom_size\": %zu,\n    \"ratio\": %.4f,\n",
+                total_size, total_rom, ratio(total_rom, total_size));
+        fprintf(f, "    \"time_ms\": %.3f,\n", (double)total_ns / 1e6);
+        json_indices(f, "slowest", slowest, ntop);
+        fprintf(f, ",\n");
+        json_indices(f, "least_compressible", worst, ntop);
+        fprintf(f, "\n  }\n}\n");
+    }
+
+    int ok = !ferror(f);
+    if (fclose(f) != 0) ok = 0;
+
+    fprintf(stderr, "entries: %d compressed, %d stored, %.1f ms encoding in total\n",
+            ncompressed, nstored, (double)total_ns / 1e6);
+    print_ranked("slowest entries", slowest, ntop);
+    print_ranked("least compressible entries", worst, ntop);
+
+    free(slowest);
+    free(worst);
+    return ok;
+}
\ No newline at end of file
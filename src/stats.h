@@ -0,0 +1,18 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "dma.h"
+
+/* Entries listed in each part of the summary */
+#define STATS_TOP 10
+
+/*
+ * Write per-entry statistics of a compressed ROM's DMA table to path:
+ * CSV if the name ends in .csv, JSON otherwise. The table must have been
+ * compressed with opts->stats set; rom_data is the input ROM, for the
+ * CRC-32 of each file's contents. Also prints the slowest and the least
+ * compressible entries to stderr. Returns 0 if path cannot be written.
+ */
+int write_stats(const char *path, const dma_table_t *dma, const uint8_t *rom_data);
+
+#endif /* STATS_H */
\ No newline at end of file
@@ -0,0 +1,230 @@
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE  /* sysconf(_SC_NPROCESSORS_ONLN) */
+#endif
+
+#include "thread.h"
+#include "util.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+/* --- Threads and mutexes --- */
+
+typedef struct {
+    void (*fn)(void *);
+    void *arg;
+} thread_start_t;
+
+#ifdef _WIN32
+static DWORD WINAPI thread_entry(LPVOID p) {
+#else
+static void *thread_entry(void *p) {
+#endif
+    thread_start_t st = *(thread_start_t *)p;
+    free(p);
+    st.fn(st.arg);
+    return 0;
+}
+
+int thread_start(thread_t *t, void (*fn)(void *), void *arg) {
+    thread_start_t *st = (thread_start_t *)malloc(sizeof(*st));
+    if (!st) return 0;
+    st->fn = fn;
+    st->arg = arg;
+#ifdef _WIN32
+    *t = CreateThread(NULL, 0, thread_entry, st, 0, NULL);
+    if (*t == NULL) { free(st); return 0; }
+#else
+    if (pthread_create(t, NULL, thread_entry, st) != 0) { free(st); return 0; }
+#endif
+    return 1;
+}
+
+void thread_join(thread_t t) {
+#ifdef _WIN32
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+#else
+    pthread_join(t, NULL);
+#endif
+}
+
+#ifdef _WIN32
+void mutex_init(mutex_t *m)    { InitializeCriticalSection(m); }
+void mutex_lock(mutex_t *m)    { EnterCriticalSection(m); }
+void mutex_unlock(mutex_t *m)  { LeaveCriticalSection(m); }
+void mutex_destroy(mutex_t *m) { DeleteCriticalSection(m); }
+#else
+void mutex_init(mutex_t *m)    { pthread_mutex_init(m, NULL); }
+void mutex_lock(mutex_t *m)    { pthread_mutex_lock(m); }
+void mutex_unlock(mutex_t *m)  { pthread_mutex_unlock(m); }
+void mutex_destroy(mutex_t *m) { pthread_mutex_destroy(m); }
+#endif
+
+#ifdef _WIN32
+void cond_init(cond_t *c)             { InitializeConditionVariable(c); }
+void cond_wait(cond_t *c, mutex_t *m) { SleepConditionVariableCS(c, m, INFINITE); }
+void cond_broadcast(cond_t *c)        { WakeAllConditionVariable(c); }
+void cond_destroy(cond_t *c)          { (void)c; }
+#else
+void cond_init(cond_t *c)             { pthread_cond_init(c, NULL); }
+void cond_wait(cond_t *c, mutex_t *m) { pthread_cond_wait(c, m); }
+void cond_broadcast(cond_t *c)        { pthread_cond_broadcast(c); }
+void cond_destroy(cond_t *c)          { pthread_cond_destroy(c); }
+#endif
+
+#ifdef _WIN32
+typedef struct {
+    void (*fn)(void);
+} once_fn_t;
+
+static BOOL CALLBACK once_entry(PINIT_ONCE once, PVOID param, PVOID *ctx) {
+    (void)once;
+    (void)ctx;
+    ((once_fn_t *)param)->fn();
+    return TRUE;
+}
+
+void thread_once(once_t *once, void (*fn)(void)) {
+    once_fn_t box = { fn };
+    InitOnceExecuteOnce(once, once_entry, &box, NULL);
+}
+#else
+void thread_once(once_t *once, void (*fn)(void)) { pthread_once(once, fn); }
+#endif
+
+int cpu_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors > 0 ? (int)si.dwNumberOfProcessors : 1;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+/* --- Work-stealing parallel for --- */
+
+typedef struct {
+    mutex_t lock;
+    int    *items;
+    int     head, tail;   /* pending items are items[head..tail) */
+} work_queue_t;
+
+typedef struct {
+    void (*task)(void *ctx, int i, int worker);
+    void         *ctx;
+    work_queue_t *queues;
+    int           nqueues;
+} pfor_t;
+
+typedef struct {
+    pfor_t *pf;
+    int     worker;
+} pfor_worker_t;
+
+static int queue_pop_front(work_queue_t *q, int *out) {
+    int ok = 0;
+    mutex_lock(&q->lock);
+    if (q->head < q->tail) {
+        *out = q->items[q->head++];
+        ok = 1;
+    }
+    mutex_unlock(&q->lock);
+    return ok;
+}
+
+static int queue_pop_back(work_queue_t *q, int *out) {
+    int ok = 0;
+    mutex_lock(&q->lock);
+    if (q->head < q->tail) {
+        *out = q->items[--q->tail];
+        ok = 1;
+    }
+    mutex_unlock(&q->lock);
+    return ok;
+}
+
+static void pfor_worker(void *arg) {
+    pfor_worker_t *w = (pfor_worker_t *)arg;
+    pfor_t *pf = w->pf;
+    int i;
+
+    for (;;) {
+        if (!queue_pop_front(&pf->queues[w->worker], &i)) {
+            /* Own queue drained: steal from the others */
+            int found = 0;
+            for (int k = 1; k < pf->nqueues && !found; k++) {
+                int victim = (w->worker + k) % pf->nqueues;
+                found = queue_pop_back(&pf->queues[victim], &i);
+            }
+            if (!found) break;
+        }
+        pf->task(pf->ctx, i, w->worker);
+    }
+}
+
+void parallel_for(int threads, int n,
+                  void (*task)(void *ctx, int i, int worker), void *ctx) {
+    if (threads <= 0) threads = cpu_count();
+    if (threads > n) threads = n;
+    if (threads <= 1) {
+        for (int i = 0; i < n; i++)
+            task(ctx, i, 0);
+        return;
+    }
+
+    pfor_t pf;
+    pf.task = task;
+    pf.ctx = ctx;
+    pf.nqueues = threads;
+    pf.queues = (work_queue_t *)malloc((size_t)threads * sizeof(work_queue_t));
+    int *items = (int *)malloc((size_t)n * sizeof(int));
+    thread_t *tids = (thread_t *)malloc((size_t)threads * sizeof(thread_t));
+    pfor_worker_t *workers =
+        (pfor_worker_t *)malloc((size_t)threads * sizeof(pfor_worker_t));
+    if (!pf.queues || !items || !tids || !workers) {
+        /* No room for the queues: run everything on this thread */
+        free(pf.queues);
+        free(items);
+        free(tids);
+        free(workers);
+        for (int i = 0; i < n; i++)
+            task(ctx, i, 0);
+        return;
+    }
+
+    /* Queue w holds w, w + threads, w + 2*threads, ... */
+    int ofs = 0;
+    for (int w = 0; w < threads; w++) {
+        work_queue_t *q = &pf.queues[w];
+        mutex_init(&q->lock);
+        q->items = items + ofs;
+        q->head = 0;
+        q->tail = 0;
+        for (int i = w; i < n; i += threads)
+            q->items[q->tail++] = i;
+        ofs += q->tail;
+        workers[w].pf = &pf;
+        workers[w].worker = w;
+    }
+
+    /* The calling thread is worker 0 */
+    int started = 1;
+    for (int w = 1; w < threads; w++) {
+        if (!thread_start(&tids[w], pfor_worker, &workers[w])) break;
+        started++;
+    }
+    pfor_worker(&workers[0]);
+    for (int w = 1; w < started; w++)
+        thread_join(tids[w]);
+
+    for (int w = 0; w < threads; w++)
+        mutex_destroy(&pf.queues[w].lock);
+    free(workers);
+    free(tids);
+    free(items);
+    free(pf.queues);
+}
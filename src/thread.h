@@ -0,0 +1,58 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+/* Minimal threading layer: Win32 threads on Windows, pthreads elsewhere */
+
+#ifdef _WIN32
+#include <windows.h>
+typedef HANDLE             thread_t;
+typedef CRITICAL_SECTION   mutex_t;
+typedef CONDITION_VARIABLE cond_t;
+typedef INIT_ONCE          once_t;
+#define THREAD_ONCE_INIT   INIT_ONCE_STATIC_INIT
+#else
+#include <pthread.h>
+typedef pthread_t          thread_t;
+typedef pthread_mutex_t    mutex_t;
+typedef pthread_cond_t     cond_t;
+typedef pthread_once_t     once_t;
+#define THREAD_ONCE_INIT   PTHREAD_ONCE_INIT
+#endif
+
+/* Start fn(arg) on a new thread. Returns 0 on failure. */
+int  thread_start(thread_t *t, void (*fn)(void *), void *arg);
+void thread_join(thread_t t);
+
+void mutex_init(mutex_t *m);
+void mutex_lock(mutex_t *m);
+void mutex_unlock(mutex_t *m);
+void mutex_destroy(mutex_t *m);
+
+/* Condition variables; cond_wait releases m while it sleeps */
+void cond_init(cond_t *c);
+void cond_wait(cond_t *c, mutex_t *m);
+void cond_broadcast(cond_t *c);
+void cond_destroy(cond_t *c);
+
+/* Run fn once per once_t (initialized to THREAD_ONCE_INIT). Threads
+ * arriving meanwhile wait until it has returned. */
+void thread_once(once_t *once, void (*fn)(void));
+
+/* Number of online CPUs (at least 1) */
+int cpu_count(void);
+
+/*
+ * Run task(ctx, i, worker) for every i in [0, n) on up to `threads`
+ * workers (0 = one per CPU) and wait for all of them. worker is in
+ * [0, threads) and identifies the calling thread, for per-worker scratch.
+ *
+ * Indices are dealt round-robin to per-worker queues in ascending order.
+ * A worker takes the lowest index from its own queue and, once that is
+ * empty, steals the highest index from another. Callers that sort their
+ * work largest first therefore start the big items first and leave the
+ * small ones for balancing the tail.
+ */
+void parallel_for(int threads, int n,
+                  void (*task)(void *ctx, int i, int worker), void *ctx);
+
+#endif /* THREAD_H */
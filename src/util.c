@@ -1,9 +1,14 @@
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE  /* clock_gettime */
+#endif
+
 #include "util.h"
 
-void die(const char *msg) {
-    fprintf(stderr, "error: %s\n", msg);
-    exit(1);
-}
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
 
 uint32_t get32(const uint8_t *data, size_t offset) {
     return ((uint32_t)data[offset] << 24) |
@@ -19,6 +24,37 @@ void put32(uint8_t *data, size_t offset, uint32_t value) {
     data[offset+3] = (uint8_t)(value);
 }
 
+static uint64_t hash_mix(uint64_t h, uint64_t w) {
+    h ^= w * 0xC2B2AE3D27D4EB4Full;
+    h = (h << 31) | (h >> 33);
+    return h * 0x9E3779B97F4A7C15ull;
+}
+
+/* Words are read in host byte order, so keys are per-endianness */
+uint64_t hash64(const uint8_t *data, size_t size) {
+    uint64_t h = 0x27D4EB2F165667C5ull ^ size;
+    size_t i = 0;
+
+    for (; i + 8 <= size; i += 8) {
+        uint64_t w;
+        memcpy(&w, data + i, 8);
+        h = hash_mix(h, w);
+    }
+    if (i < size) {
+        uint64_t w = 0;
+        memcpy(&w, data + i, size - i);
+        h = hash_mix(h, w);
+    }
+
+    /* Final avalanche */
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+    return h;
+}
+
 size_t align16(size_t size) {
     return (size + 15) & ~(size_t)15;
 }
@@ -28,28 +64,29 @@ size_t align8mb(size_t size) {
     return ((size + a - 1) / a) * a;
 }
 
-/* --- buf_t --- */
-
-void buf_init(buf_t *b, size_t initial_cap) {
-    if (initial_cap < 64) initial_cap = 64;
-    b->data = (uint8_t *)malloc(initial_cap);
-    if (!b->data) die("out of memory");
-    b->len = 0;
-    b->cap = initial_cap;
+uint64_t time_ns(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
 }
 
-static void buf_ensure(buf_t *b, size_t extra) {
-    if (b->len + extra > b->cap) {
-        while (b->len + extra > b->cap)
-            b->cap *= 2;
-        b->data = (uint8_t *)realloc(b->data, b->cap);
-        if (!b->data) die("out of memory");
-    }
-}
+/* --- buf_t --- */
 
-void buf_push8(buf_t *b, uint8_t v) {
-    buf_ensure(b, 1);
-    b->data[b->len++] = v;
+int buf_try_reserve(buf_t *b, size_t cap) {
+    if (cap <= b->cap) return 1;
+    uint8_t *p = (uint8_t *)realloc(b->data, cap);
+    if (!p) return 0;
+    b->data = p;
+    b->cap = cap;
+    return 1;
 }
 
 void buf_free(buf_t *b) {
@@ -58,52 +95,18 @@ void buf_free(buf_t *b) {
     b->len = b->cap = 0;
 }
 
-/* --- u32arr_t --- */
-
-void u32arr_init(u32arr_t *a, size_t initial_cap) {
-    if (initial_cap < 16) initial_cap = 16;
-    a->data = (uint32_t *)malloc(initial_cap * sizeof(uint32_t));
-    if (!a->data) die("out of memory");
-    a->len = 0;
-    a->cap = initial_cap;
-}
-
-void u32arr_push(u32arr_t *a, uint32_t v) {
-    if (a->len >= a->cap) {
-        a->cap *= 2;
-        a->data = (uint32_t *)realloc(a->data, a->cap * sizeof(uint32_t));
-        if (!a->data) die("out of memory");
-    }
-    a->data[a->len++] = v;
-}
-
-void u32arr_free(u32arr_t *a) {
-    free(a->data);
-    a->data = NULL;
-    a->len = a->cap = 0;
-}
-
-/* --- u16arr_t --- */
-
-void u16arr_init(u16arr_t *a, size_t initial_cap) {
-    if (initial_cap < 16) initial_cap = 16;
-    a->data = (uint16_t *)malloc(initial_cap * sizeof(uint16_t));
-    if (!a->data) die("out of memory");
-    a->len = 0;
-    a->cap = initial_cap;
-}
-
-void u16arr_push(u16arr_t *a, uint16_t v) {
-    if (a->len >= a->cap) {
-        a->cap *= 2;
-        a->data = (uint16_t *)realloc(a->data, a->cap * sizeof(uint16_t));
-        if (!a->data) die("out of memory");
-    }
-    a->data[a->len++] = v;
-}
-
-void u16arr_free(u16arr_t *a) {
-    free(a->data);
-    a->data = NULL;
-    a->len = a->cap = 0;
+/* --- Files --- */
+
+uint8_t *load_file(const char *path, long *out_len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = (uint8_t *)malloc(len);
+    if (!data) { fclose(f); return NULL; }
+    if (fread(data, 1, len, f) != (size_t)len) { free(data); fclose(f); return NULL; }
+    fclose(f);
+    *out_len = len;
+    return data;
 }
\ No newline at end of file
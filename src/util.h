@@ -6,17 +6,20 @@
 #include <string.h>
 #include <stdint.h>
 
-/* Fatal error - prints message and exits */
-void die(const char *msg);
-
 /* Big-endian 32-bit read/write */
 uint32_t get32(const uint8_t *data, size_t offset);
 void     put32(uint8_t *data, size_t offset, uint32_t value);
 
+/* Fast 64-bit hash for content keys (not cryptographic) */
+uint64_t hash64(const uint8_t *data, size_t size);
+
 /* Alignment helpers */
 size_t align16(size_t size);
 size_t align8mb(size_t size);
 
+/* Monotonic clock in nanoseconds, for timing */
+uint64_t time_ns(void);
+
 /* Dynamic byte buffer */
 typedef struct {
     uint8_t *data;
@@ -24,30 +27,12 @@ typedef struct {
     size_t   cap;
 } buf_t;
 
-void buf_init(buf_t *b, size_t initial_cap);
-void buf_push8(buf_t *b, uint8_t v);
+/* Start from a zeroed buf_t. Ensure room for at least cap bytes in total;
+ * returns 0, leaving b as it was, if out of memory. */
+int  buf_try_reserve(buf_t *b, size_t cap);
 void buf_free(buf_t *b);
 
-/* Dynamic uint32_t array */
-typedef struct {
-    uint32_t *data;
-    size_t    len;
-    size_t    cap;
-} u32arr_t;
-
-void u32arr_init(u32arr_t *a, size_t initial_cap);
-void u32arr_push(u32arr_t *a, uint32_t v);
-void u32arr_free(u32arr_t *a);
-
-/* Dynamic uint16_t array */
-typedef struct {
-    uint16_t *data;
-    size_t    len;
-    size_t    cap;
-} u16arr_t;
-
-void u16arr_init(u16arr_t *a, size_t initial_cap);
-void u16arr_push(u16arr_t *a, uint16_t v);
-void u16arr_free(u16arr_t *a);
+/* Read a whole file into a new buffer; NULL if it cannot be read */
+uint8_t *load_file(const char *path, long *out_len);
 
 #endif /* UTIL_H */
\ No newline at end of file
@@ -0,0 +1,249 @@
+#include "verify.h"
+#include "util.h"
+#include "yaz0.h"
+#include "n64crc.h"
+#include "dma.h"
+#include "romdb.h"
+#include "thread.h"
+#include "yaz0encdec.h"
+
+#include <stdarg.h>
+
+/* One DMA entry to check */
+typedef struct {
+    int      index;
+    uint32_t vstart, vend;
+    uint32_t pstart, pend;
+    uint32_t pfile_end;  /* end of the file's bytes in the ROM */
+    char     fail[96];   /* why the entry failed, empty while it passes */
+} ver_job_t;
+
+typedef struct {
+    const uint8_t *comp;
+    const uint8_t *source;
+    uint32_t       dma_start, dma_end;  /* vrom of the DMA table */
+    ver_job_t     *jobs;
+    buf_t         *scratch;  /* one per worker, for decoding */
+} ver_ctx_t;
+
+/* Record the first problem found with an entry */
+static void fail(ver_job_t *j, const char *fmt, ...) {
+    if (j->fail[0]) return;
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(j->fail, sizeof(j->fail), fmt, ap);
+    va_end(ap);
+}
+
+/*
+ * Offset of the first byte of a file that differs from the source, or its
+ * size if none does. The header checksum and the DMA table are rewritten
+ * by compression and are skipped.
+ */
+static size_t source_diff(const ver_ctx_t *ctx, const ver_job_t *j, const uint8_t *data) {
+    const uint8_t *ref = ctx->source + j->vstart;
+    size_t size = j->vend - j->vstart;
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] == ref[i]) continue;
+        uint32_t v = j->vstart + (uint32_t)i;
+        if (v >= 0x10 && v < 0x18) continue;
+        if (v >= ctx->dma_start && v < ctx->dma_end) continue;
+        return i;
+    }
+    return size;
+}
+
+static int cmp_by_index(const void *a, const void *b) {
+    return ((const ver_job_t *)a)->index - ((const ver_job_t *)b)->index;
+}
+
+static int cmp_by_vstart(const void *a, const void *b) {
+    const ver_job_t *ja = (const ver_job_t *)a, *jb = (const ver_job_t *)b;
+    if (ja->vstart != jb->vstart) return (ja->vstart < jb->vstart) ? -1 : 1;
+    return ja->index - jb->index;
+}
+
+static int cmp_by_pstart(const void *a, const void *b) {
+    const ver_job_t *ja = (const ver_job_t *)a, *jb = (const ver_job_t *)b;
+    if (ja->pstart != jb->pstart) return (ja->pstart < jb->pstart) ? -1 : 1;
+    return ja->index - jb->index;
+}
+
+/* Largest decompressed size first; ties in DMA order */
+static int cmp_by_size_desc(const void *a, const void *b) {
+    const ver_job_t *ja = (const ver_job_t *)a, *jb = (const ver_job_t *)b;
+    uint32_t sa = ja->vend - ja->vstart, sb = jb->vend - jb->vstart;
+    if (sa != sb) return (sa > sb) ? -1 : 1;
+    return ja->index - jb->index;
+}
+
+static void verify_task(void *arg, int k, int worker) {
+    ver_ctx_t *ctx = (ver_ctx_t *)arg;
+    ver_job_t *j = &ctx->jobs[k];
+    if (j->fail[0]) return;
+
+    size_t size = j->vend - j->vstart;
+    const uint8_t *data = ctx->comp + j->pstart;
+    const uint8_t *ref = ctx->source ? ctx->source + j->vstart : NULL;
+
+    size_t at;
+    if (j->pend == 0) {
+        /* Stored file */
+        if (ref && memcmp(data, ref, size) != 0 && (at = source_diff(ctx, j, data)) < size)
+            fail(j, "differs from the source at +0x%zX", at);
+        return;
+    }
+
+    /* Compressed file: decode it whole, then compare */
+    size_t len = j->pend - j->pstart;
+    buf_t *b = &ctx->scratch[worker];
+    if (!buf_try_reserve(b, size)) {
+        fail(j, "%s", yed_strerror(YED_ERR_NOMEM));
+        return;
+    }
+    size_t n;
+    int err = yaz0_decode_checked(data, len, b->data, size, &n);
+    if (err != YAZ0_OK)
+        fail(j, "%s", yaz0_strerror(err));
+    else if (n != size)
+        fail(j, "decodes to %zu bytes instead of %zu", n, size);
+    else if (ref && memcmp(b->data, ref, size) != 0 &&
+             (at = source_diff(ctx, j, b->data)) < size)
+        fail(j, "differs from the source at +0x%zX", at);
+}
+
+/* Whether the header checksum is current; 1 if the CIC is unknown */
+static int check_header_crc(const uint8_t *comp, size_t comp_size, int quiet) {
+    if (comp_size < N64CRC_SPAN) return 0;
+    uint8_t *head = (uint8_t *)malloc(N64CRC_SPAN);
+    if (!head) return 1;
+    memcpy(head, comp, N64CRC_SPAN);
+    int ok = 1;
+    if (n64crc(head))
+        ok = memcmp(head + 0x10, comp + 0x10, 8) == 0;
+    else if (!quiet)
+        fprintf(stderr, "warning: unknown CIC chip, checksum not checked\n");
+    free(head);
+    return ok;
+}
+
+int verify_rom(const uint8_t *comp, size_t comp_size,
+               const uint8_t *source, size_t source_size, int threads, int quiet) {
+    const rom_version_t *ver = detect_rom_version(comp, comp_size);
+    if (!ver) {
+        if (!quiet) fprintf(stderr, "error: could not identify ROM version\n");
+        return YED_ERR_UNKNOWN_ROM;
+    }
+    size_t dma_start = ver->dma_offset;
+    int dma_num = ver->dma_count;
+    if (dma_start + (size_t)dma_num * 16 > comp_size) {
+        if (!quiet) fprintf(stderr, "error: dmadata lies outside the ROM\n");
+        return YED_ERR_DMA;
+    }
+
+    /* Collect the entries that carry data, checking their bounds */
+    ver_job_t *jobs = (ver_job_t *)malloc((size_t)(dma_num + 1) * sizeof(ver_job_t));
+    if (!jobs) return YED_ERR_NOMEM;
+    int njobs = 0;
+
+    for (int i = 0; i < dma_num; i++) {
+        size_t eofs = dma_start + (size_t)i * 16;
+        uint32_t vstart = get32(comp, eofs);
+        uint32_t vend   = get32(comp, eofs + 4);
+        uint32_t pstart = get32(comp, eofs + 8);
+        uint32_t pend   = get32(comp, eofs + 12);
+
+        /* Same entries as decompress skips */
+        if (pstart == DMA_DELETED || vstart == DMA_DELETED ||
+            pend == DMA_DELETED || vend == DMA_DELETED ||
+            vend <= vstart || (pend && pend == pstart))
+            continue;
+
+        ver_job_t *j = &jobs[njobs++];
+        j->index     = i;
+        j->vstart    = vstart;
+        j->vend      = vend;
+        j->pstart    = pstart;
+        j->pend      = pend;
+        j->pfile_end = pend ? pend : pstart + (vend - vstart);
+        j->fail[0]   = '\0';
+
+        if (j->pfile_end < pstart || j->pfile_end > comp_size) {
+            fail(j, "0x%X-0x%X lies outside the ROM", pstart, j->pfile_end);
+            j->pfile_end = pstart;
+        } else if (source && vend > source_size) {
+            fail(j, "vrom 0x%X-0x%X lies outside the source ROM", vstart, vend);
+        }
+    }
+
+    /* No two files may claim the same vrom */
+    qsort(jobs, (size_t)njobs, sizeof(ver_job_t), cmp_by_vstart);
+    for (int k = 1, last = 0; k < njobs; k++) {
+        if (jobs[k].vstart < jobs[last].vend) {
+            fail(&jobs[k], "overlaps entry %d in vrom", jobs[last].index);
+            fail(&jobs[last], "overlaps entry %d in vrom", jobs[k].index);
+        }
+        if (jobs[k].vend > jobs[last].vend) last = k;
+    }
+
+    /* Nor the same ROM bytes, unless they share one blob */
+    qsort(jobs, (size_t)njobs, sizeof(ver_job_t), cmp_by_pstart);
+    for (int k = 1, last = 0; k < njobs; k++) {
+        const ver_job_t *p = &jobs[last];
+        int shared = jobs[k].pstart == p->pstart && jobs[k].pend == p->pend;
+        if (jobs[k].pstart < p->pfile_end && !shared) {
+            fail(&jobs[k], "overlaps entry %d in the ROM", p->index);
+            fail(&jobs[last], "overlaps entry %d in the ROM", jobs[k].index);
+        }
+        if (jobs[k].pfile_end > p->pfile_end) last = k;
+    }
+
+    /* Largest first, so the long decodes start early and small ones fill in */
+    qsort(jobs, (size_t)njobs, sizeof(ver_job_t), cmp_by_size_desc);
+
+    int nworkers = (threads > 0) ? threads : cpu_count();
+    buf_t *scratch = (buf_t *)calloc((size_t)nworkers, sizeof(buf_t));
+    if (!scratch) {
+        free(jobs);
+        return YED_ERR_NOMEM;
+    }
+    ver_ctx_t ctx;
+    ctx.comp = comp;
+    ctx.source = source;
+    ctx.dma_start = (uint32_t)dma_start;
+    ctx.dma_end = (uint32_t)(dma_start + (size_t)dma_num * 16);
+    ctx.jobs = jobs;
+    ctx.scratch = scratch;
+    parallel_for(threads, njobs, verify_task, &ctx);
+    for (int w = 0; w < nworkers; w++)
+        buf_free(&scratch[w]);
+    free(scratch);
+
+    /* Report in DMA order */
+    qsort(jobs, (size_t)njobs, sizeof(ver_job_t), cmp_by_index);
+    int failed = 0, decoded = 0;
+    for (int k = 0; k < njobs; k++) {
+        if (jobs[k].fail[0]) {
+            failed++;
+            if (!quiet)
+                fprintf(stderr, "error: entry %d: %s\n", jobs[k].index, jobs[k].fail);
+        } else if (jobs[k].pend != 0) {
+            decoded++;
+        }
+    }
+    free(jobs);
+
+    int crc_ok = check_header_crc(comp, comp_size, quiet);
+    if (!crc_ok && !quiet)
+        fprintf(stderr, "error: header checksum does not match\n");
+
+    if (!quiet) {
+        if (failed)
+            fprintf(stderr, "verify: %d of %d files failed\n", failed, njobs);
+        else
+            fprintf(stderr, "verify: %d files ok (%d compressed, %d stored)%s\n",
+                    njobs, decoded, njobs - decoded,
+                    source ? ", identical to the source" : "");
+    }
+    return (failed || !crc_ok) ? YED_ERR_VERIFY : YED_OK;
+}
\ No newline at end of file
@@ -0,0 +1,23 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Check a compressed OoT ROM without writing it out unpacked. Every DMA
+ * entry must lie inside the ROM, no two entries may overlap in vrom or,
+ * unless they share one blob, in the ROM, every compressed file must
+ * decode cleanly to exactly its vrom size, and the header checksum must
+ * be current. With source (the uncompressed ROM it was made from, NULL
+ * if not at hand) every file must also match source[vstart..vend).
+ * Entries are checked on up to `threads` workers (0 = one per CPU).
+ *
+ * Returns YED_OK, YED_ERR_VERIFY if any check fails, or
+ * YED_ERR_UNKNOWN_ROM, YED_ERR_DMA or YED_ERR_NOMEM if the ROM could not
+ * be checked. Unless quiet, every failed entry and a summary go to stderr.
+ */
+int verify_rom(const uint8_t *comp, size_t comp_size,
+               const uint8_t *source, size_t source_size, int threads, int quiet);
+
+#endif /* VERIFY_H */
\ No newline at end of file
@@ -1,260 +1,974 @@
 #include "yaz0.h"
 #include "util.h"
+#include "match.h"
+#include "thread.h"
 
 /* --- Encoder internals --- */
 
-static int enc_find(const uint8_t *data, size_t array_ofs, size_t needle_ofs,
-                    int needle_len, int start_index, int source_length) {
-    int limit = source_length - needle_len + 1;
-    if (limit <= 0) return -1;
+/* Candidates examined per position by the greedy level */
+#define GREEDY_MAX_CHAIN  16
 
-    uint8_t needle_first = data[needle_ofs];
+static int match_limit(int pos, int sz) {
+    int left = sz - pos;
+    return (left < YAZ0_MAX_MATCH) ? left : YAZ0_MAX_MATCH;
+}
 
-    while (start_index < limit) {
-        int index = -1;
-        for (int r = start_index; r < limit; r++) {
-            if (data[array_ofs + r] == needle_first) {
-                index = r;
-                break;
-            }
+/*
+ * Token writer. Tokens go straight to the output; each group of eight is
+ * preceded by a flag byte that is reserved when the group starts.
+ */
+typedef struct {
+    uint8_t *out;     /* next output byte */
+    uint8_t *flags;   /* flag byte of the current group */
+    uint8_t  mask;    /* flag bit of the next token, 0 = start a group */
+} tokens_t;
+
+static void next_flag(tokens_t *t) {
+    if (t->mask == 0) {
+        t->flags = t->out++;
+        *t->flags = 0;
+        t->mask = 0x80;
+    }
+}
+
+static void emit_literal(tokens_t *t, uint8_t v) {
+    next_flag(t);
+    *t->flags |= t->mask;
+    t->mask >>= 1;
+    *t->out++ = v;
+}
+
+/* Match of hitl bytes starting dist bytes back */
+static void emit_match(tokens_t *t, int dist, int hitl) {
+    int e = dist - 1;
+    next_flag(t);
+    t->mask >>= 1;
+    if (hitl < 0x12) {
+        *t->out++ = (uint8_t)(((hitl - 2) << 4) | (e >> 8));
+        *t->out++ = (uint8_t)e;
+    } else {
+        *t->out++ = (uint8_t)(e >> 8);
+        *t->out++ = (uint8_t)e;
+        *t->out++ = (uint8_t)(hitl - 0x12);
+    }
+}
+
+/*
+ * Per-worker scratch: a match finder and the optimal parser's arrays,
+ * sized for the longest range seen so far.
+ */
+typedef struct {
+    matchfinder_t mf;
+    size_t        cap;     /* positions the arrays can hold */
+    uint16_t     *lens;
+    int32_t      *hits;
+    uint32_t     *cost;
+    int32_t      *deque;
+} enc_scratch_t;
+
+/* Returns 0 if out of memory */
+static int scratch_reserve(enc_scratch_t *sc, size_t n) {
+    if (n <= sc->cap) return 1;
+    free(sc->lens);
+    free(sc->hits);
+    free(sc->cost);
+    free(sc->deque);
+    sc->lens  = (uint16_t *)malloc(n * sizeof(uint16_t));
+    sc->hits  = (int32_t *)malloc(n * sizeof(int32_t));
+    sc->cost  = (uint32_t *)malloc((n + 1) * sizeof(uint32_t));
+    sc->deque = (int32_t *)malloc((n + 2) * sizeof(int32_t));
+    if (!sc->lens || !sc->hits || !sc->cost || !sc->deque) {
+        free(sc->lens);
+        free(sc->hits);
+        free(sc->cost);
+        free(sc->deque);
+        sc->lens = NULL;
+        sc->hits = NULL;
+        sc->cost = NULL;
+        sc->deque = NULL;
+        sc->cap = 0;
+        return 0;
+    }
+    sc->cap = n;
+    return 1;
+}
+
+/*
+ * The parsers encode data[start..end). Matches never extend past end but
+ * may reach back before start, as far as the match finder was primed.
+ */
+
+/* Take the longest match at every position */
+static void parse_greedy(tokens_t *t, matchfinder_t *mf,
+                         const uint8_t *data, int start, int end) {
+    int pos = start;
+    while (pos < end) {
+        int hitp;
+        int hitl = mf_find(mf, pos, match_limit(pos, end), &hitp);
+        if (hitl < 3) {
+            emit_literal(t, data[pos]);
+            pos += 1;
+        } else {
+            emit_match(t, pos - hitp, hitl);
+            pos += hitl;
         }
-        if (index == -1) return -1;
+    }
+}
 
-        int found = 1;
-        for (int i = 0; i < needle_len; i++) {
-            if (data[array_ofs + index + i] != data[needle_ofs + i]) {
-                found = 0;
-                break;
-            }
+/*
+ * Greedy, but a match is deferred by one literal when the match at the
+ * next position is more than one byte longer.
+ */
+static void parse_lazy(tokens_t *t, matchfinder_t *mf,
+                       const uint8_t *data, int start, int end) {
+    int pos = start;
+    while (pos < end) {
+        int hitp;
+        int hitl = mf_find(mf, pos, match_limit(pos, end), &hitp);
+
+        if (hitl < 3) {
+            emit_literal(t, data[pos]);
+            pos += 1;
+            continue;
+        }
+
+        int tstp;
+        int tstl = mf_find(mf, pos + 1, match_limit(pos + 1, end), &tstp);
+        if ((hitl + 1) < tstl) {
+            emit_literal(t, data[pos]);
+            pos += 1;
+            hitl = tstl;
+            hitp = tstp;
         }
-        if (found) return index;
 
-        start_index = index + 1;
+        emit_match(t, pos - hitp, hitl);
+        pos += hitl;
     }
-    return -1;
 }
 
-static void enc_search(const uint8_t *data, int pos, int sz, int cap,
-                        int *out_hitp, int *out_hitl) {
-    int mp = (pos > 0x1000) ? (pos - 0x1000) : 0;
-    int ml = (cap < (sz - pos)) ? cap : (sz - pos);
-    if (ml < 3) {
-        *out_hitp = 0;
-        *out_hitl = 0;
-        return;
+/* Token sizes in bits, flag bit included */
+#define COST_LITERAL  9
+#define COST_SHORT    17  /* 2-byte match, 3..0x11 bytes */
+#define COST_LONG     25  /* 3-byte match, 0x12..0x111 bytes */
+
+/*
+ * Optimal parse: choose the token sequence with the fewest bits. The
+ * stream is one flag byte per 8 tokens plus the payload, so for any parse
+ * 8 * size lies within 7 of its bit count, and the minimum bit count also
+ * gives the minimum byte size.
+ *
+ * cost[i] is the cheapest encoding of data[start + i..end), computed back
+ * to front. Short matches are tried one length at a time; for long
+ * matches the cheapest end point in [i + 0x12, i + len] comes from a
+ * monotonic deque, which works because i + len never grows as i
+ * decreases. Returns 0 if out of memory.
+ */
+static int parse_optimal(tokens_t *t, enc_scratch_t *sc,
+                          const uint8_t *data, int start, int end) {
+    int sz = end - start;
+    const uint8_t *src = data + start;
+    matchfinder_t *mf = &sc->mf;
+
+    if (!scratch_reserve(sc, (size_t)sz)) return 0;
+    uint16_t *lens  = sc->lens;
+    int32_t  *hits  = sc->hits;
+    uint32_t *cost  = sc->cost;
+    int32_t  *deque = sc->deque;
+
+    /* hits[] holds distances */
+    for (int i = 0; i < sz; i++) {
+        int hitp;
+        lens[i] = (uint16_t)mf_find(mf, start + i,
+                                    match_limit(start + i, end), &hitp);
+        hits[i] = start + i - hitp;
     }
 
-    int hitp = 0;
-    int hitl = 3;
-
-    if (mp < pos) {
-        int hl = enc_find(data, mp, pos, hitl, 0, pos + hitl - mp);
-        while (hl >= 0 && hl < (pos - mp)) {
-            while (hitl < ml && data[pos + hitl] == data[mp + hl + hitl])
-                hitl++;
-            mp += hl;
-            hitp = mp;
-            if (hitl == ml) {
-                *out_hitp = hitp;
-                *out_hitl = hitl;
-                return;
+    /* lens[] is overwritten with the chosen token length. The deque holds
+     * end points from low to high, their costs falling towards the back. */
+    int lo = sz + 1, hi = sz + 1;
+    cost[sz] = 0;
+    for (int i = sz - 1; i >= 0; i--) {
+        int j = i + 0x12;
+        if (j <= sz) {
+            while (lo < hi && cost[deque[lo]] >= cost[j]) lo++;
+            deque[--lo] = j;
+        }
+
+        int len = lens[i];
+        uint32_t best = COST_LITERAL + cost[i + 1];
+        int choice = 1;
+
+        int short_max = (len < 0x11) ? len : 0x11;
+        for (int l = 3; l <= short_max; l++) {
+            if (COST_SHORT + cost[i + l] < best) {
+                best = COST_SHORT + cost[i + l];
+                choice = l;
             }
-            mp += 1;
-            hitl += 1;
-            if (mp >= pos) break;
-            hl = enc_find(data, mp, pos, hitl, 0, pos + hitl - mp);
         }
+        if (len >= 0x12) {
+            while (lo < hi && deque[hi - 1] > i + len) hi--;
+            if (lo < hi && COST_LONG + cost[deque[hi - 1]] < best) {
+                best = COST_LONG + cost[deque[hi - 1]];
+                choice = deque[hi - 1] - i;
+            }
+        }
+        cost[i] = best;
+        lens[i] = (uint16_t)choice;
     }
 
-    if (hitl < 4) hitl = 1;
-    *out_hitp = hitp;
-    *out_hitl = hitl - 1;
+    int i = 0;
+    while (i < sz) {
+        int l = lens[i];
+        if (l == 1)
+            emit_literal(t, src[i]);
+        else
+            emit_match(t, hits[i], l);
+        i += l;
+    }
+    return 1;
 }
 
-/* --- Public API --- */
+struct yaz0_encoder {
+    yaz0_params_t  params;
+    int            nworkers;
+    enc_scratch_t *scratch;    /* one per worker */
+    buf_t          out;        /* staging for yaz0_encoder_encode */
+    buf_t         *chunks;     /* split mode token streams, chunk 1.. */
+    int            nchunks;
+};
+
+/*
+ * Encode data[start..end) with a match finder primed on the window before.
+ * Returns 0 if out of memory.
+ */
+static int encode_range(yaz0_encoder_t *enc, int worker, tokens_t *t,
+                        const uint8_t *data, int start, int end) {
+    enc_scratch_t *sc = &enc->scratch[worker];
+    mf_reset(&sc->mf, data, end, (start > YAZ0_WINDOW) ? start - YAZ0_WINDOW : 0);
+
+    switch (enc->params.level) {
+        case YAZ0_LEVEL_GREEDY:
+            parse_greedy(t, &sc->mf, data, start, end);
+            return 1;
+        case YAZ0_LEVEL_OPTIMAL:
+            return parse_optimal(t, sc, data, start, end);
+        default:
+            parse_lazy(t, &sc->mf, data, start, end);
+            return 1;
+    }
+}
 
-uint8_t *yaz0_encode(const uint8_t *data, size_t data_size, size_t *out_size) {
-    if (data_size == 0) {
-        uint8_t *hdr = (uint8_t *)calloc(16, 1);
-        if (!hdr) die("out of memory");
-        memcpy(hdr, "Yaz0", 4);
-        *out_size = 16;
-        return hdr;
+/* Append a complete token stream, regrouping its flag bits */
+static void append_tokens(tokens_t *t, const uint8_t *src, size_t len) {
+    const uint8_t *end = src + len;
+    uint8_t flags = 0;
+    int bits = 0;
+
+    while (src < end) {
+        if (bits == 0) {
+            flags = *src++;
+            bits = 8;
+        }
+        if (flags & 0x80) {
+            emit_literal(t, *src++);
+        } else {
+            int n = (src[0] >> 4) ? 2 : 3;
+            next_flag(t);
+            t->mask >>= 1;
+            memcpy(t->out, src, n);
+            t->out += n;
+            src += n;
+        }
+        flags <<= 1;
+        bits--;
     }
+}
 
-    int cap = 0x111;
-    int sz = (int)data_size;
-    int pos = 0;
-    uint32_t flag = 0x80000000u;
+/*
+ * Split encoding: chunk k covers data[k * split..], is parsed on its own
+ * with the 4 KiB before it as match history, and writes a private token
+ * stream. Chunk 0 goes straight to the output; the others are regrouped
+ * onto it in order. Chunk boundaries depend only on split, so the output
+ * is the same for any number of workers.
+ */
+typedef struct {
+    yaz0_encoder_t *enc;
+    const uint8_t  *data;
+    int             size;
+    int             split;
+    tokens_t        first;    /* chunk 0, written in place */
+    int             first_ok;
+} split_job_t;
+
+/* Chunk length marking a chunk that ran out of memory */
+#define CHUNK_FAILED  ((size_t)-1)
+
+static void split_task(void *ctx, int k, int worker) {
+    split_job_t *job = (split_job_t *)ctx;
+    int start = k * job->split;
+    int end = (job->size - start > job->split) ? start + job->split : job->size;
+
+    if (k == 0) {
+        job->first_ok = encode_range(job->enc, worker, &job->first, job->data, start, end);
+        return;
+    }
 
-    buf_t raws;
-    u16arr_t ctrl;
-    u32arr_t cmds;
+    buf_t *b = &job->enc->chunks[k];
+    b->len = CHUNK_FAILED;
+    if (!buf_try_reserve(b, yaz0_compress_bound((size_t)(end - start))))
+        return;
+    tokens_t t;
+    t.out = b->data;
+    t.flags = NULL;
+    t.mask = 0;
+    if (encode_range(job->enc, worker, &t, job->data, start, end))
+        b->len = (size_t)(t.out - b->data);
+}
 
-    buf_init(&raws, data_size / 2);
-    u16arr_init(&ctrl, data_size / 8);
-    u32arr_init(&cmds, data_size / 32 + 1);
+/* Returns 0 if out of memory */
+static int encode_split(yaz0_encoder_t *enc, tokens_t *t,
+                        const uint8_t *data, int size) {
+    size_t split = enc->params.split_size;
+    int nchunks = (int)(((size_t)size + split - 1) / split);
+
+    if (nchunks > enc->nchunks) {
+        buf_t *chunks = (buf_t *)realloc(enc->chunks, (size_t)nchunks * sizeof(buf_t));
+        if (!chunks) return 0;
+        enc->chunks = chunks;
+        memset(&chunks[enc->nchunks], 0, (size_t)(nchunks - enc->nchunks) * sizeof(buf_t));
+        enc->nchunks = nchunks;
+    }
 
-    u32arr_push(&cmds, 0);
+    split_job_t job;
+    job.enc = enc;
+    job.data = data;
+    job.size = size;
+    job.split = (int)split;
+    job.first = *t;
+    job.first_ok = 0;
+
+    parallel_for(enc->nworkers, nchunks, split_task, &job);
+
+    if (!job.first_ok) return 0;
+    for (int k = 1; k < nchunks; k++)
+        if (enc->chunks[k].len == CHUNK_FAILED) return 0;
+    *t = job.first;
+    for (int k = 1; k < nchunks; k++)
+        append_tokens(t, enc->chunks[k].data, enc->chunks[k].len);
+    return 1;
+}
 
-    while (pos < sz) {
-        int hitp, hitl;
-        enc_search(data, pos, sz, cap, &hitp, &hitl);
+/* --- Decoder internals --- */
+
+/*
+ * The wide copies below may write up to WILD_COPY - 1 bytes past the end
+ * of a token, so they are only used while that much room is left in the
+ * output. Later tokens overwrite the excess.
+ */
+#define WILD_COPY  16
+
+/* Most a group of eight tokens can read and write, wide copies included */
+#define GROUP_MAX_SRC  (1 + 8 * 3)
+#define GROUP_MAX_DST  (8 * YAZ0_MAX_MATCH + WILD_COPY)
+
+/* Copy a len byte match from dist bytes back; may overrun as above */
+static void copy_match_wide(uint8_t *d, size_t dist, int len) {
+    const uint8_t *s = d - dist;
+    uint8_t *end = d + len;
+
+    if (dist >= 16) {
+        do {
+            memcpy(d, s, 16);
+            d += 16;
+            s += 16;
+        } while (d < end);
+    } else if (dist >= 8) {
+        do {
+            memcpy(d, s, 8);
+            d += 8;
+            s += 8;
+        } while (d < end);
+    } else if (dist == 1) {
+        memset(d, *s, (size_t)len);
+    } else {
+        /* Lay the pattern down until it repeats at a distance of at least
+         * eight, then copy whole words from that far back */
+        size_t step = dist;
+        while (step < 8) step += dist;
+        for (size_t i = 0; i < step; i++)
+            d[i] = s[i];
+        for (d += step; d < end; d += 8)
+            memcpy(d, d - step, 8);
+    }
+}
 
-        if (hitl < 3) {
-            buf_push8(&raws, data[pos]);
-            cmds.data[cmds.len - 1] |= flag;
-            pos += 1;
-        } else {
-            int tstp, tstl;
-            enc_search(data, pos + 1, sz, cap, &tstp, &tstl);
-            if ((hitl + 1) < tstl) {
-                buf_push8(&raws, data[pos]);
-                cmds.data[cmds.len - 1] |= flag;
-                pos += 1;
-                flag >>= 1;
-                if (flag == 0) {
-                    flag = 0x80000000u;
-                    u32arr_push(&cmds, 0);
-                }
-                hitl = tstl;
-                hitp = tstp;
-            }
+/* --- Public API --- */
 
-            int e = pos - hitp - 1;
-            pos += hitl;
+void yaz0_default_params(yaz0_params_t *params) {
+    params->level  = YAZ0_LEVEL_LAZY;
+    params->engine = YAZ0_ENGINE_AUTO;
+    params->split_size = 0;
+    params->threads = 1;
+}
 
-            if (hitl < 0x12) {
-                hitl -= 2;
-                u16arr_push(&ctrl, (uint16_t)((hitl << 12) | e));
-            } else {
-                u16arr_push(&ctrl, (uint16_t)e);
-                buf_push8(&raws, (uint8_t)(hitl - 0x12));
-            }
-        }
+size_t yaz0_compress_bound(size_t data_size) {
+    /* All literals: one flag byte per eight input bytes */
+    return 16 + data_size + (data_size + 7) / 8;
+}
 
-        flag >>= 1;
-        if (flag == 0) {
-            flag = 0x80000000u;
-            u32arr_push(&cmds, 0);
+yaz0_encoder_t *yaz0_encoder_new(const yaz0_params_t *params) {
+    yaz0_encoder_t *enc = (yaz0_encoder_t *)calloc(1, sizeof(*enc));
+    if (!enc) return NULL;
+    if (params)
+        enc->params = *params;
+    else
+        yaz0_default_params(&enc->params);
+
+    int engine = enc->params.engine;
+    if (engine == YAZ0_ENGINE_AUTO)
+        engine = (enc->params.level == YAZ0_LEVEL_OPTIMAL) ? YAZ0_ENGINE_BINTREE
+                                                           : YAZ0_ENGINE_HASHCHAIN;
+
+    /* Only split encoding runs more than one worker */
+    enc->nworkers = 1;
+    if (enc->params.split_size > 0)
+        enc->nworkers = enc->params.threads > 0 ? enc->params.threads : cpu_count();
+
+    enc->scratch = (enc_scratch_t *)calloc((size_t)enc->nworkers, sizeof(enc_scratch_t));
+    if (!enc->scratch) {
+        free(enc);
+        return NULL;
+    }
+    for (int w = 0; w < enc->nworkers; w++) {
+        if (!mf_init(&enc->scratch[w].mf, engine)) {
+            yaz0_encoder_free(enc);
+            return NULL;
         }
+        if (enc->params.level == YAZ0_LEVEL_GREEDY)
+            enc->scratch[w].mf.max_chain = GREEDY_MAX_CHAIN;
     }
 
-    if (flag == 0x80000000u)
-        cmds.len--;
-
-    /* Build ctl byte array (4 bytes per cmd) */
-    size_t ctl_byte_len = cmds.len * 4;
-    uint8_t *ctl_bytes = (uint8_t *)malloc(ctl_byte_len);
-    if (!ctl_bytes) die("out of memory");
-    for (size_t i = 0; i < cmds.len; i++) {
-        uint32_t cmd = cmds.data[i];
-        ctl_bytes[i*4]   = (uint8_t)((cmd >> 24) & 0xFF);
-        ctl_bytes[i*4+1] = (uint8_t)((cmd >> 16) & 0xFF);
-        ctl_bytes[i*4+2] = (uint8_t)((cmd >> 8) & 0xFF);
-        ctl_bytes[i*4+3] = (uint8_t)(cmd & 0xFF);
+    /* enc->out stays empty until yaz0_encoder_encode needs it */
+    return enc;
+}
+
+void yaz0_encoder_free(yaz0_encoder_t *enc) {
+    if (!enc) return;
+    for (int w = 0; w < enc->nworkers; w++) {
+        enc_scratch_t *sc = &enc->scratch[w];
+        mf_free(&sc->mf);
+        free(sc->lens);
+        free(sc->hits);
+        free(sc->cost);
+        free(sc->deque);
     }
+    free(enc->scratch);
+    for (int k = 0; k < enc->nchunks; k++)
+        buf_free(&enc->chunks[k]);
+    free(enc->chunks);
+    buf_free(&enc->out);
+    free(enc);
+}
 
-    /* Serialize stream */
-    size_t b_idx = 0, v_idx = 0, c_idx = 0;
-    uint32_t bit = 0x10000;
-    int dec_s = (int)data_size;
+size_t yaz0_encoder_encode_into(yaz0_encoder_t *enc,
+                                const uint8_t *data, size_t data_size,
+                                uint8_t *dst, size_t dst_cap) {
+    if (dst_cap < yaz0_compress_bound(data_size))
+        return 0;
 
-    buf_t out;
-    buf_init(&out, data_size);
+    memset(dst, 0, 16);
+    memcpy(dst, "Yaz0", 4);
+    put32(dst, 4, (uint32_t)data_size);
+    if (data_size == 0)
+        return 16;
 
-    while (dec_s > 0) {
-        if (bit > 0xFFFF) {
-            bit = ctl_bytes[b_idx++];
-            buf_push8(&out, (uint8_t)(bit & 0xFF));
-            bit |= 0x100;
+    int sz = (int)data_size;
+
+    tokens_t tok;
+    tok.out = dst + 16;
+    tok.flags = NULL;
+    tok.mask = 0;
+
+    int ok;
+    if (enc->params.split_size > 0 && data_size > enc->params.split_size)
+        ok = encode_split(enc, &tok, data, sz);
+    else
+        ok = encode_range(enc, 0, &tok, data, 0, sz);
+
+    return ok ? (size_t)(tok.out - dst) : 0;
+}
+
+const uint8_t *yaz0_encoder_encode(yaz0_encoder_t *enc,
+                                   const uint8_t *data, size_t data_size,
+                                   size_t *out_size) {
+    size_t bound = yaz0_compress_bound(data_size);
+    if (!buf_try_reserve(&enc->out, bound)) return NULL;
+    enc->out.len = yaz0_encoder_encode_into(enc, data, data_size,
+                                            enc->out.data, bound);
+    if (enc->out.len == 0) return NULL;
+    *out_size = enc->out.len;
+    return enc->out.data;
+}
+
+uint8_t *yaz0_encode(const uint8_t *data, size_t data_size, size_t *out_size) {
+    return yaz0_encode_ex(data, data_size, NULL, out_size);
+}
+
+uint8_t *yaz0_encode_ex(const uint8_t *data, size_t data_size,
+                        const yaz0_params_t *params, size_t *out_size) {
+    size_t bound = yaz0_compress_bound(data_size);
+    uint8_t *result = (uint8_t *)malloc(bound);
+    if (!result) return NULL;
+
+    size_t total = yaz0_encode_into(data, data_size, result, bound, params);
+    if (total == 0) {
+        free(result);
+        return NULL;
+    }
+
+    uint8_t *shrunk = (uint8_t *)realloc(result, total);
+    *out_size = total;
+    return shrunk ? shrunk : result;
+}
+
+size_t yaz0_encode_into(const uint8_t *data, size_t data_size,
+                        uint8_t *dst, size_t dst_cap,
+                        const yaz0_params_t *params) {
+    yaz0_encoder_t *enc = yaz0_encoder_new(params);
+    if (!enc) return 0;
+    size_t total = yaz0_encoder_encode_into(enc, data, data_size, dst, dst_cap);
+    yaz0_encoder_free(enc);
+    return total;
+}
+
+const char *yaz0_strerror(int err) {
+    switch (err) {
+        case YAZ0_OK:            return "success";
+        case YAZ0_ERR_HEADER:    return "invalid Yaz0 header";
+        case YAZ0_ERR_TRUNCATED: return "truncated Yaz0 data";
+        case YAZ0_ERR_DST_SIZE:  return "Yaz0 output larger than destination";
+        case YAZ0_ERR_DISTANCE:  return "Yaz0 match before start of output";
+        case YAZ0_ERR_OVERRUN:   return "Yaz0 match past end of output";
+        case YAZ0_ERR_NOMEM:     return "out of memory";
+        default:                 return "unknown Yaz0 error";
+    }
+}
+
+int yaz0_decode_checked(const uint8_t *src, size_t src_size,
+                        uint8_t *dst, size_t dst_cap, size_t *out_size) {
+    if (src_size < 16 || memcmp(src, "Yaz0", 4) != 0)
+        return YAZ0_ERR_HEADER;
+
+    size_t size = get32(src, 4);
+    if (size > dst_cap)
+        return YAZ0_ERR_DST_SIZE;
+
+    const uint8_t *sp = src + 16;
+    const uint8_t *send = src + src_size;
+    uint8_t *dp = dst;
+    uint8_t *dend = dst + size;
+
+    /* Fast loop: a whole group of eight tokens, wide copies included, is
+     * known to fit in both buffers, so only match distances are checked */
+    while (send - sp >= GROUP_MAX_SRC && dend - dp >= GROUP_MAX_DST) {
+        uint8_t flags = *sp++;
+        if (flags == 0xFF) {
+            memcpy(dp, sp, 8);
+            dp += 8;
+            sp += 8;
+            continue;
         }
-        if (bit & 0x80) {
-            buf_push8(&out, raws.data[v_idx++]);
-            dec_s -= 1;
-        } else {
-            uint16_t val = ctrl.data[c_idx++];
-            buf_push8(&out, (uint8_t)((val >> 8) & 0xFF));
-            buf_push8(&out, (uint8_t)(val & 0xFF));
-            int length_nibble = (val >> 12) & 0xF;
-            if (length_nibble == 0) {
-                uint8_t extra = raws.data[v_idx++];
-                buf_push8(&out, extra);
-                length_nibble = extra + 16;
+        for (int k = 0; k < 8; k++, flags <<= 1) {
+            if (flags & 0x80) {
+                *dp++ = *sp++;
+                continue;
             }
-            dec_s -= length_nibble + 2;
+            size_t dist = ((size_t)(sp[0] & 0x0F) << 8 | sp[1]) + 1;
+            int len = sp[0] >> 4;
+            if (len == 0) {
+                len = sp[2] + 0x12;
+                sp += 3;
+            } else {
+                len += 2;
+                sp += 2;
+            }
+            if (dist > (size_t)(dp - dst))
+                return YAZ0_ERR_DISTANCE;
+            copy_match_wide(dp, dist, len);
+            dp += len;
         }
-        bit <<= 1;
     }
 
-    /* 16-byte header + compressed stream */
-    size_t total = 16 + out.len;
-    uint8_t *result = (uint8_t *)malloc(total);
-    if (!result) die("out of memory");
-    memset(result, 0, 16);
-    memcpy(result, "Yaz0", 4);
-    put32(result, 4, (uint32_t)data_size);
-    memcpy(result + 16, out.data, out.len);
-    *out_size = total;
+    /* Tail: check every token against both ends */
+    uint8_t flags = 0;
+    int bits = 0;
+    while (dp < dend) {
+        if (bits == 0) {
+            if (sp >= send) return YAZ0_ERR_TRUNCATED;
+            flags = *sp++;
+            bits = 8;
+        }
+
+        if (flags & 0x80) {
+            if (sp >= send) return YAZ0_ERR_TRUNCATED;
+            *dp++ = *sp++;
+        } else {
+            if (send - sp < 2) return YAZ0_ERR_TRUNCATED;
+            size_t dist = ((size_t)(sp[0] & 0x0F) << 8 | sp[1]) + 1;
+            int len = sp[0] >> 4;
+            if (len == 0) {
+                if (send - sp < 3) return YAZ0_ERR_TRUNCATED;
+                len = sp[2] + 0x12;
+                sp += 3;
+            } else {
+                len += 2;
+                sp += 2;
+            }
+            if (dist > (size_t)(dp - dst)) return YAZ0_ERR_DISTANCE;
+            if ((size_t)len > (size_t)(dend - dp)) return YAZ0_ERR_OVERRUN;
+
+            if (dend - dp >= len + WILD_COPY) {
+                copy_match_wide(dp, dist, len);
+                dp += len;
+            } else {
+                /* Overlap copies are intentional in LZ77 */
+                const uint8_t *from = dp - dist;
+                for (int j = 0; j < len; j++)
+                    *dp++ = *from++;
+            }
+        }
 
-    free(ctl_bytes);
-    buf_free(&raws);
-    u16arr_free(&ctrl);
-    u32arr_free(&cmds);
-    buf_free(&out);
+        bits--;
+        flags <<= 1;
+    }
 
-    return result;
+    *out_size = size;
+    return YAZ0_OK;
 }
 
 uint32_t yaz0_decode(const uint8_t *src, size_t src_offset, size_t sz,
                      uint8_t *dst, size_t dst_offset) {
-    if (sz < 16)
-        die("invalid Yaz0 data: too short");
-    if (memcmp(src + src_offset, "Yaz0", 4) != 0)
-        die("invalid Yaz0 magic");
-
-    uint32_t uncomp_size = get32(src, src_offset + 4);
-
-    size_t sp = src_offset + 16; /* skip header */
-    size_t dp = dst_offset;
-    size_t end = dst_offset + uncomp_size;
-    int valid_bit_count = 0;
-    uint8_t curr_code_byte = 0;
-
-    while (dp < end) {
-        if (valid_bit_count == 0) {
-            curr_code_byte = src[sp++];
-            valid_bit_count = 8;
-        }
+    if (sz < 16) return 0;
+    size_t out;
+    if (yaz0_decode_checked(src + src_offset, sz, dst + dst_offset,
+                            get32(src, src_offset + 4), &out) != YAZ0_OK)
+        return 0;
+    return (uint32_t)out;
+}
 
-        if (curr_code_byte & 0x80) {
-            /* Literal byte */
-            dst[dp++] = src[sp++];
-        } else {
-            /* Match (copy from earlier in output) */
-            uint8_t byte1 = src[sp];
-            uint8_t byte2 = src[sp + 1];
-            sp += 2;
+/* --- Streaming --- */
+
+#define STREAM_BLOCK  0x10000   /* input encoded per step */
+#define RING_MASK     (YAZ0_WINDOW - 1)
+
+struct yaz0_stream_decoder {
+    uint8_t  head[16];
+    int      head_len;
+    uint32_t size;        /* uncompressed size from the header */
+    uint32_t produced;    /* output so far; also the window write position */
+    uint8_t  flags;
+    int      bits;        /* tokens left in the current group */
+    uint8_t  tok[3];      /* match token read so far */
+    int      tok_len;
+    uint32_t dist;        /* pending match */
+    int      copy_len;
+    int      error;
+    uint8_t  window[YAZ0_WINDOW];
+};
+
+yaz0_stream_decoder_t *yaz0_stream_decoder_new(void) {
+    return (yaz0_stream_decoder_t *)calloc(1, sizeof(yaz0_stream_decoder_t));
+}
 
-            uint32_t dist = ((byte1 & 0x0F) << 8) | byte2;
-            size_t copy_src = dp - (dist + 1);
+void yaz0_stream_decoder_free(yaz0_stream_decoder_t *d) {
+    free(d);
+}
 
-            int num_bytes = byte1 >> 4;
-            if (num_bytes == 0) {
-                num_bytes = src[sp++] + 0x12;
+int yaz0_stream_decoder_run(yaz0_stream_decoder_t *d,
+                            const uint8_t *in, size_t *in_len,
+                            uint8_t *out, size_t *out_len) {
+    const uint8_t *ip = in, *iend = in + *in_len;
+    uint8_t *op = out, *oend = out + *out_len;
+    int ret = d->error;
+
+    if (ret != YAZ0_OK) goto done;
+
+    while (d->head_len < 16 && ip < iend)
+        d->head[d->head_len++] = *ip++;
+    if (d->head_len < 16) goto done;
+    if (memcmp(d->head, "Yaz0", 4) != 0) {
+        ret = YAZ0_ERR_HEADER;
+        goto done;
+    }
+    d->size = get32(d->head, 4);
+
+    for (;;) {
+        /* Finish the pending match in runs that neither wrap the window
+         * nor read bytes written by the same run */
+        while (d->copy_len > 0 && op < oend) {
+            size_t wp = d->produced & RING_MASK;
+            size_t rp = (d->produced - d->dist) & RING_MASK;
+            size_t n = (size_t)d->copy_len;
+            if (n > (size_t)(oend - op)) n = (size_t)(oend - op);
+            if (n > d->dist) n = d->dist;
+            if (n > YAZ0_WINDOW - wp) n = YAZ0_WINDOW - wp;
+            if (n > YAZ0_WINDOW - rp) n = YAZ0_WINDOW - rp;
+            memmove(d->window + wp, d->window + rp, n);
+            memcpy(op, d->window + wp, n);
+            op += n;
+            d->produced += (uint32_t)n;
+            d->copy_len -= (int)n;
+        }
+        if (d->copy_len > 0) break;
+        if (d->produced == d->size) {
+            ret = YAZ0_STREAM_END;
+            break;
+        }
+
+        if (d->bits == 0) {
+            if (ip == iend) break;
+            d->flags = *ip++;
+            d->bits = 8;
+        }
+
+        if (d->flags & 0x80) {
+            if (ip == iend || op == oend) break;
+            d->window[d->produced++ & RING_MASK] = *ip;
+            *op++ = *ip++;
+        } else {
+            while (d->tok_len < 2 && ip < iend)
+                d->tok[d->tok_len++] = *ip++;
+            if (d->tok_len < 2) break;
+            int len = d->tok[0] >> 4;
+            if (len == 0) {
+                if (d->tok_len < 3) {
+                    if (ip == iend) break;
+                    d->tok[d->tok_len++] = *ip++;
+                }
+                len = d->tok[2] + 0x12;
             } else {
-                num_bytes += 2;
+                len += 2;
             }
+            d->tok_len = 0;
 
-            /* Copy one byte at a time (overlap copies are intentional in LZ77) */
-            for (int j = 0; j < num_bytes; j++) {
-                dst[dp++] = dst[copy_src++];
+            uint32_t dist = ((uint32_t)(d->tok[0] & 0x0F) << 8 | d->tok[1]) + 1;
+            if (dist > d->produced) {
+                ret = YAZ0_ERR_DISTANCE;
+                break;
+            }
+            if ((uint32_t)len > d->size - d->produced) {
+                ret = YAZ0_ERR_OVERRUN;
+                break;
             }
+            d->dist = dist;
+            d->copy_len = len;
         }
 
-        valid_bit_count--;
-        curr_code_byte <<= 1;
+        d->bits--;
+        d->flags <<= 1;
+    }
+
+    if (ret < 0) d->error = ret;
+done:
+    *in_len = (size_t)(ip - in);
+    *out_len = (size_t)(op - out);
+    return ret;
+}
+
+struct yaz0_stream_encoder {
+    yaz0_encoder_t *enc;
+    uint32_t size;        /* total input size */
+    uint32_t consumed;    /* input accepted so far */
+    uint8_t *buf;         /* history, then input not yet encoded */
+    size_t   hist, len;   /* buf[0..hist) history, buf[hist..len) pending */
+    buf_t    out;         /* encoded stream not yet handed out */
+    size_t   out_pos;     /* out.data[0..out_pos) already handed out */
+    size_t   flags_ofs;   /* open flag byte in out, valid while mask != 0 */
+    uint8_t  mask;
+    int      error;
+};
+
+yaz0_stream_encoder_t *yaz0_stream_encoder_new(const yaz0_params_t *params,
+                                               uint32_t size) {
+    yaz0_params_t p;
+    if (params)
+        p = *params;
+    else
+        yaz0_default_params(&p);
+    p.split_size = 0;
+    p.threads = 1;
+
+    yaz0_stream_encoder_t *se = (yaz0_stream_encoder_t *)calloc(1, sizeof(*se));
+    if (!se) return NULL;
+    se->enc = yaz0_encoder_new(&p);
+    se->size = size;
+    se->buf = (uint8_t *)malloc(YAZ0_WINDOW + STREAM_BLOCK);
+    if (!se->enc || !se->buf ||
+        !buf_try_reserve(&se->out, yaz0_compress_bound(STREAM_BLOCK))) {
+        yaz0_stream_encoder_free(se);
+        return NULL;
+    }
+
+    memset(se->out.data, 0, 16);
+    memcpy(se->out.data, "Yaz0", 4);
+    put32(se->out.data, 4, size);
+    se->out.len = 16;
+    return se;
+}
+
+void yaz0_stream_encoder_free(yaz0_stream_encoder_t *se) {
+    if (!se) return;
+    yaz0_encoder_free(se->enc);
+    free(se->buf);
+    buf_free(&se->out);
+    free(se);
+}
+
+/*
+ * Encode the pending input, then keep the last window of it as history.
+ * Returns 0 if out of memory.
+ */
+static int stream_encode_block(yaz0_stream_encoder_t *se) {
+    /* Drop what has been handed out; only an open group remains */
+    size_t shift = se->out_pos;
+    memmove(se->out.data, se->out.data + shift, se->out.len - shift);
+    se->out.len -= shift;
+    se->flags_ofs -= shift;
+    se->out_pos = 0;
+
+    if (!buf_try_reserve(&se->out, se->out.len + yaz0_compress_bound(se->len - se->hist)))
+        return 0;
+    tokens_t t;
+    t.out = se->out.data + se->out.len;
+    t.flags = se->mask ? se->out.data + se->flags_ofs : NULL;
+    t.mask = se->mask;
+    if (!encode_range(se->enc, 0, &t, se->buf, (int)se->hist, (int)se->len))
+        return 0;
+    se->out.len = (size_t)(t.out - se->out.data);
+    se->mask = t.mask;
+    if (t.mask) se->flags_ofs = (size_t)(t.flags - se->out.data);
+
+    size_t keep = (se->len < YAZ0_WINDOW) ? se->len : YAZ0_WINDOW;
+    memmove(se->buf, se->buf + se->len - keep, keep);
+    se->hist = se->len = keep;
+    return 1;
+}
+
+int yaz0_stream_encoder_run(yaz0_stream_encoder_t *se,
+                            const uint8_t *in, size_t *in_len,
+                            uint8_t *out, size_t *out_len) {
+    const uint8_t *ip = in;
+    size_t in_left = *in_len;
+    uint8_t *op = out;
+    size_t out_left = *out_len;
+    int finished;
+
+    if (se->error != YAZ0_OK) {
+        *in_len = 0;
+        *out_len = 0;
+        return se->error;
     }
 
-    return uncomp_size;
+    for (;;) {
+        /* An open flag byte may still gain bits, unless nothing follows */
+        finished = (se->consumed == se->size && se->len == se->hist);
+        size_t ready = (se->mask && !finished) ? se->flags_ofs : se->out.len;
+        size_t n = ready - se->out_pos;
+        if (n > out_left) n = out_left;
+        memcpy(op, se->out.data + se->out_pos, n);
+        op += n;
+        out_left -= n;
+        se->out_pos += n;
+
+        size_t take = se->hist + STREAM_BLOCK - se->len;
+        if (take > se->size - se->consumed) take = se->size - se->consumed;
+        if (take > in_left) take = in_left;
+        memcpy(se->buf + se->len, ip, take);
+        ip += take;
+        in_left -= take;
+        se->len += take;
+        se->consumed += (uint32_t)take;
+
+        /* Encode once the block is full (or the input complete) and the
+         * previous one has been drained, so staging stays one block */
+        size_t pending = se->len - se->hist;
+        if (pending > 0 && se->out_pos == ready &&
+            (pending == STREAM_BLOCK || se->consumed == se->size)) {
+            if (stream_encode_block(se)) continue;
+            se->error = YAZ0_ERR_NOMEM;
+            *in_len = (size_t)(ip - in);
+            *out_len = (size_t)(op - out);
+            return se->error;
+        }
+        break;
+    }
+
+    *in_len = (size_t)(ip - in);
+    *out_len = (size_t)(op - out);
+    return (finished && se->out_pos == se->out.len) ? YAZ0_STREAM_END : YAZ0_OK;
+}
+
+/* Output compared per call by yaz0_decodes_to */
+#define VERIFY_CHUNK  0x4000
+
+size_t yaz0_decodes_to(const uint8_t *src, size_t src_size,
+                       const uint8_t *data, size_t size) {
+    if (src_size < 16 || get32(src, 4) != size) return 0;
+
+    yaz0_stream_decoder_t dec;
+    yaz0_stream_decoder_t *d = &dec;
+    memset(d, 0, sizeof(*d));
+    uint8_t chunk[VERIFY_CHUNK];
+    size_t in_pos = 0, out_pos = 0;
+    int ret;
+
+    do {
+        size_t in_len = src_size - in_pos;
+        size_t out_len = sizeof(chunk);
+        ret = yaz0_stream_decoder_run(d, src + in_pos, &in_len, chunk, &out_len);
+        if (out_len > size - out_pos ||
+            memcmp(chunk, data + out_pos, out_len) != 0) {
+            ret = YAZ0_ERR_OVERRUN;
+            break;
+        }
+        in_pos += in_len;
+        out_pos += out_len;
+        if (ret == YAZ0_OK && in_len == 0 && out_len == 0)
+            ret = YAZ0_ERR_TRUNCATED;
+    } while (ret == YAZ0_OK);
+
+    return (ret == YAZ0_STREAM_END && out_pos == size) ? in_pos : 0;
+}
+
+void yaz0_count_tokens(const uint8_t *src, size_t src_size,
+                       uint32_t *literals, uint32_t *matches) {
+    uint32_t lits = 0, refs = 0;
+    size_t size = (src_size >= 16) ? get32(src, 4) : 0;
+    size_t sp = 16, produced = 0;
+
+    while (produced < size && sp < src_size) {
+        uint8_t flags = src[sp++];
+        for (int k = 0; k < 8 && produced < size && sp < src_size; k++, flags <<= 1) {
+            if (flags & 0x80) {
+                sp++;
+                produced++;
+                lits++;
+                continue;
+            }
+            if (sp + 2 > src_size) break;
+            int len = src[sp] >> 4;
+            if (len == 0) {
+                if (sp + 3 > src_size) break;
+                len = src[sp + 2] + 0x12;
+                sp += 3;
+            } else {
+                len += 2;
+                sp += 2;
+            }
+            produced += (size_t)len;
+            refs++;
+        }
+    }
+    *literals = lits;
+    *matches = refs;
 }
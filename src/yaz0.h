@@ -4,19 +4,197 @@
 #include <stdint.h>
 #include <stddef.h>
 
+/*
+ * libyaz0encdec is built with hidden visibility; only the functions
+ * declared between YED_API_BEGIN and YED_API_END here and in
+ * yaz0encdec.h are exported from the shared library.
+ */
+#if defined(__GNUC__) && !defined(_WIN32)
+#define YED_API_BEGIN _Pragma("GCC visibility push(default)")
+#define YED_API_END   _Pragma("GCC visibility pop")
+#else
+#define YED_API_BEGIN
+#define YED_API_END
+#endif
+
+/* Bumped whenever the encoder's output changes for the same parameters */
+#define YAZ0_ENCODER_VERSION  1
+
+/* Compression levels */
+#define YAZ0_LEVEL_GREEDY   1  /* fastest: longest match at each position */
+#define YAZ0_LEVEL_LAZY     2  /* one-byte lookahead (default) */
+#define YAZ0_LEVEL_OPTIMAL  3  /* smallest output, dynamic programming */
+
+/* Match finder engines */
+#define YAZ0_ENGINE_AUTO       0  /* binary tree for the optimal level,
+                                     hash chains otherwise (default) */
+#define YAZ0_ENGINE_HASHCHAIN  1  /* hash chains */
+#define YAZ0_ENGINE_BINTREE    2  /* binary search trees, log-time searches */
+
+/* Encoder settings */
+typedef struct {
+    int    level;       /* YAZ0_LEVEL_* */
+    int    engine;      /* YAZ0_ENGINE_* */
+    size_t split_size;  /* encode larger inputs as independent chunks of
+                           this many bytes, 0 = never */
+    int    threads;     /* workers for split chunks, 0 = one per CPU */
+} yaz0_params_t;
+
+YED_API_BEGIN
+
+/* Fill in the default encoder settings */
+void yaz0_default_params(yaz0_params_t *params);
+
 /*
  * Compress data into Yaz0 format.
  * Returns a newly allocated buffer containing the full Yaz0 stream
- * (16-byte header + compressed data). Sets *out_size to the total size.
+ * (16-byte header + compressed data), or NULL if out of memory.
+ * Sets *out_size to the total size.
  */
 uint8_t *yaz0_encode(const uint8_t *data, size_t data_size, size_t *out_size);
 
+/*
+ * Same as yaz0_encode with explicit settings (NULL = defaults).
+ * Both engines find matches of the same length, so at the lazy and
+ * optimal levels the output has the same size; only match distances may
+ * differ. The greedy level bounds the hash chain search and may miss the
+ * longest match.
+ *
+ * With split_size set, chunks are parsed in parallel, each seeing the
+ * preceding 4 KiB as match history, and joined into one stream. No match
+ * crosses a chunk boundary, which costs a little ratio; the output
+ * depends on split_size but not on the number of threads.
+ */
+uint8_t *yaz0_encode_ex(const uint8_t *data, size_t data_size,
+                        const yaz0_params_t *params, size_t *out_size);
+
+/* Largest possible Yaz0 stream (header included) for data_size bytes */
+size_t yaz0_compress_bound(size_t data_size);
+
+/*
+ * Compress into a caller-provided buffer of at least
+ * yaz0_compress_bound(data_size) bytes, writing header, flag bytes and
+ * tokens in a single pass. Returns the stream size, or 0 if dst_cap is
+ * below the bound or memory runs out.
+ */
+size_t yaz0_encode_into(const uint8_t *data, size_t data_size,
+                        uint8_t *dst, size_t dst_cap,
+                        const yaz0_params_t *params);
+
+/*
+ * Reusable encoder. It owns the match finder tables, the optimal parser
+ * arrays, split chunk buffers and an output staging buffer, all kept and
+ * grown across calls, so encoding many files costs a handful of
+ * allocations in total. One encoder must not be used by two threads at
+ * once; create one per worker.
+ */
+typedef struct yaz0_encoder yaz0_encoder_t;
+
+/* NULL if out of memory */
+yaz0_encoder_t *yaz0_encoder_new(const yaz0_params_t *params);
+void            yaz0_encoder_free(yaz0_encoder_t *enc);
+
+/* yaz0_encode_into with the encoder's settings and scratch */
+size_t yaz0_encoder_encode_into(yaz0_encoder_t *enc,
+                                const uint8_t *data, size_t data_size,
+                                uint8_t *dst, size_t dst_cap);
+
+/*
+ * Compress into the encoder's staging buffer. The returned stream stays
+ * valid until the next call on this encoder; NULL if out of memory.
+ */
+const uint8_t *yaz0_encoder_encode(yaz0_encoder_t *enc,
+                                   const uint8_t *data, size_t data_size,
+                                   size_t *out_size);
+
+/* Results of yaz0_decode_checked */
+#define YAZ0_OK              0
+#define YAZ0_ERR_HEADER     -1  /* shorter than a header or bad magic */
+#define YAZ0_ERR_TRUNCATED  -2  /* stream ends before the output is complete */
+#define YAZ0_ERR_DST_SIZE   -3  /* uncompressed size exceeds dst_cap */
+#define YAZ0_ERR_DISTANCE   -4  /* match reaches back before the output */
+#define YAZ0_ERR_OVERRUN    -5  /* match runs past the uncompressed size */
+#define YAZ0_ERR_NOMEM      -6  /* streaming encoder: out of memory */
+#define YAZ0_STREAM_END      1  /* streaming: all output has been produced */
+
+/* Describe a YAZ0_ERR_* code */
+const char *yaz0_strerror(int err);
+
+/*
+ * Decompress the Yaz0 stream src[0..src_size) into dst[0..dst_cap).
+ * Never reads or writes outside those ranges, whatever the input. On
+ * success returns YAZ0_OK and stores the uncompressed size in *out_size;
+ * otherwise returns a YAZ0_ERR_* code and dst holds partial output.
+ */
+int yaz0_decode_checked(const uint8_t *src, size_t src_size,
+                        uint8_t *dst, size_t dst_cap, size_t *out_size);
+
 /*
  * Decompress Yaz0 data from src[src_offset..] into dst[dst_offset..].
- * sz is the total compressed size including the 16-byte header.
- * Returns the uncompressed size.
+ * sz is the total compressed size including the 16-byte header, and dst
+ * must have room for the size the header declares.
+ * Returns the uncompressed size, or 0 if the data is malformed.
+ * Kept for existing callers; yaz0_decode_checked also takes the size of
+ * dst and says what is wrong.
  */
 uint32_t yaz0_decode(const uint8_t *src, size_t src_offset, size_t sz,
                      uint8_t *dst, size_t dst_offset);
 
+/*
+ * Check that the Yaz0 stream src[0..src_size) decodes to exactly
+ * data[0..size), comparing as it decodes instead of buffering the output.
+ * Returns the length of the stream, header included and padding
+ * excluded, or 0 if it does not match.
+ */
+size_t yaz0_decodes_to(const uint8_t *src, size_t src_size,
+                       const uint8_t *data, size_t size);
+
+/*
+ * Count the literal and match tokens of the Yaz0 stream src[0..src_size).
+ * Stops at the uncompressed size from the header or the end of src,
+ * whichever comes first.
+ */
+void yaz0_count_tokens(const uint8_t *src, size_t src_size,
+                       uint32_t *literals, uint32_t *matches);
+
+/*
+ * Streaming codecs. Each call to a *_run function consumes up to *in_len
+ * bytes from in and writes up to *out_len bytes to out, then stores the
+ * amounts actually used back in *in_len and *out_len. Input and output
+ * may be split anywhere. A call returns YAZ0_OK when it needs more input
+ * or output room, YAZ0_STREAM_END once the last byte has been written,
+ * or a YAZ0_ERR_* code (which sticks). The *_new functions return NULL
+ * if out of memory.
+ */
+
+/*
+ * Decoder: keeps only the 4 KiB history window. Input past the end of
+ * the stream is left unconsumed. If the input runs out before
+ * YAZ0_STREAM_END, the stream was truncated.
+ */
+typedef struct yaz0_stream_decoder yaz0_stream_decoder_t;
+
+yaz0_stream_decoder_t *yaz0_stream_decoder_new(void);
+void yaz0_stream_decoder_free(yaz0_stream_decoder_t *d);
+int  yaz0_stream_decoder_run(yaz0_stream_decoder_t *d,
+                             const uint8_t *in, size_t *in_len,
+                             uint8_t *out, size_t *out_len);
+
+/*
+ * Encoder: the header records the uncompressed size, so it must be known
+ * up front. Input is encoded in 64 KiB blocks with the preceding 4 KiB as
+ * match history, which gives the same stream as yaz0_encode_ex with a
+ * 64 KiB split_size. params->split_size and threads are ignored.
+ */
+typedef struct yaz0_stream_encoder yaz0_stream_encoder_t;
+
+yaz0_stream_encoder_t *yaz0_stream_encoder_new(const yaz0_params_t *params,
+                                               uint32_t size);
+void yaz0_stream_encoder_free(yaz0_stream_encoder_t *se);
+int  yaz0_stream_encoder_run(yaz0_stream_encoder_t *se,
+                             const uint8_t *in, size_t *in_len,
+                             uint8_t *out, size_t *out_len);
+
+YED_API_END
+
 #endif /* YAZ0_H */
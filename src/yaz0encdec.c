@@ -0,0 +1,103 @@
+#include "yaz0encdec.h"
+#include "util.h"
+#include "n64crc.h"
+#include "crc32.h"
+#include "dma.h"
+#include "romdb.h"
+#include "compress.h"
+#include "decompress.h"
+#include "verify.h"
+
+const char *yed_strerror(int err) {
+    switch (err) {
+        case YED_ERR_UNKNOWN_ROM: return "unknown ROM version";
+        case YED_ERR_COMPRESSED:  return "ROM is already compressed";
+        case YED_ERR_DMA:         return "invalid DMA table";
+        case YED_ERR_TOO_BIG:     return "compressed data exceeds the ROM size";
+        case YED_ERR_CIC:         return "unknown CIC chip, CRC not updated";
+        case YED_ERR_ROM_SIZE:    return "ROM too small";
+        case YED_ERR_VERIFY:      return "verification failed";
+        default:                  return yaz0_strerror(err);
+    }
+}
+
+void yed_default_rom_opts(yed_rom_opts_t *opts) {
+    yaz0_default_params(&opts->yaz0);
+    opts->mb = 0;
+    opts->share_dups = 0;
+}
+
+int yed_encode(const uint8_t *data, size_t size, const yaz0_params_t *params,
+               uint8_t **out, size_t *out_size) {
+    *out = yaz0_encode_ex(data, size, params, out_size);
+    return *out ? YED_OK : YED_ERR_NOMEM;
+}
+
+int yed_decode(const uint8_t *src, size_t src_size,
+               uint8_t **out, size_t *out_size) {
+    if (src_size < 16 || memcmp(src, "Yaz0", 4) != 0)
+        return YAZ0_ERR_HEADER;
+
+    size_t size = get32(src, 4);
+    uint8_t *dst = (uint8_t *)malloc(size ? size : 1);
+    if (!dst) return YED_ERR_NOMEM;
+    int err = yaz0_decode_checked(src, src_size, dst, size, out_size);
+    if (err != YAZ0_OK) {
+        free(dst);
+        return err;
+    }
+    *out = dst;
+    return YED_OK;
+}
+
+int yed_compress_rom(const uint8_t *rom, size_t rom_size, const yed_rom_opts_t *opts,
+                     uint8_t **out, size_t *out_size) {
+    yed_rom_opts_t defaults;
+    if (!opts) {
+        yed_default_rom_opts(&defaults);
+        opts = &defaults;
+    }
+
+    const rom_version_t *ver = detect_rom_version(rom, rom_size);
+    if (!ver) return YED_ERR_UNKNOWN_ROM;
+
+    dma_table_t dma;
+    int err = parse_dma_table(&dma, rom, rom_size, ver->dma_offset, ver->dma_count);
+    if (err != YED_OK) return err;
+    err = validate_dma(&dma, rom_size);
+    if (err == YED_OK) {
+        apply_rom_config(&dma, ver);
+
+        compress_opts_t copts;
+        compress_default_opts(&copts);
+        copts.yaz0 = opts->yaz0;
+        copts.share_dups = opts->share_dups;
+        copts.quiet = 1;
+        err = compress_rom(rom, opts->mb, &dma, &copts, out, out_size);
+    }
+    free_dma_table(&dma);
+    return err;
+}
+
+int yed_decompress_rom(const uint8_t *rom, size_t rom_size, int threads,
+                       uint8_t **out, size_t *out_size) {
+    return decompress_rom(rom, rom_size, threads, 1, out, out_size);
+}
+
+int yed_verify_rom(const uint8_t *rom, size_t rom_size,
+                   const uint8_t *source, size_t source_size, int threads) {
+    return verify_rom(rom, rom_size, source, source_size, threads, 1);
+}
+
+uint32_t yed_crc32(uint32_t crc, const uint8_t *data, size_t size) {
+    return crc32_update(crc, data, size);
+}
+
+int yed_fix_crc(uint8_t *rom, size_t rom_size) {
+    if (rom_size < N64CRC_SPAN) return YED_ERR_ROM_SIZE;
+    return n64crc(rom) ? YED_OK : YED_ERR_CIC;
+}
+
+void yed_free(void *p) {
+    free(p);
+}
\ No newline at end of file
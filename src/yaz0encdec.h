@@ -0,0 +1,89 @@
+#ifndef YAZ0ENCDEC_H
+#define YAZ0ENCDEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "yaz0.h"
+
+/*
+ * libyaz0encdec: the Yaz0 codec and the OoT ROM compressor/decompressor
+ * as a library. The functions below work on memory buffers, print
+ * nothing and never exit the process; failures come back as one of the
+ * codes here. The codec calls in yaz0.h follow the same rules.
+ *
+ * Buffers returned through `out` are allocated with malloc; release them
+ * with yed_free.
+ */
+
+/* Results; YAZ0_ERR_* codes from the codec are passed through as is */
+#define YED_OK                0
+#define YED_ERR_NOMEM        YAZ0_ERR_NOMEM
+#define YED_ERR_UNKNOWN_ROM  -16  /* build date matches no known version */
+#define YED_ERR_COMPRESSED   -17  /* compressing a ROM that already is */
+#define YED_ERR_DMA          -18  /* DMA table damaged or outside the ROM */
+#define YED_ERR_TOO_BIG      -19  /* compressed data exceeds the requested size */
+#define YED_ERR_CIC          -20  /* unknown boot code, checksum not updated */
+#define YED_ERR_ROM_SIZE     -21  /* ROM shorter than its header checksum */
+#define YED_ERR_VERIFY       -22  /* compressed ROM failed verification */
+
+YED_API_BEGIN
+
+/* Describe a YED_* or YAZ0_* code */
+const char *yed_strerror(int err);
+
+/* ROM compression settings */
+typedef struct {
+    yaz0_params_t yaz0;        /* encoder settings; threads = entries in parallel */
+    int           mb;          /* output size in MiB, 0 = next multiple of 8 MiB */
+    int           share_dups;  /* identical files share one blob */
+} yed_rom_opts_t;
+
+/* Fill in the default settings */
+void yed_default_rom_opts(yed_rom_opts_t *opts);
+
+/* Yaz0-compress data[0..size) with the given settings (NULL = defaults) */
+int yed_encode(const uint8_t *data, size_t size, const yaz0_params_t *params,
+               uint8_t **out, size_t *out_size);
+
+/* Decompress a Yaz0 stream into a buffer sized from its header */
+int yed_decode(const uint8_t *src, size_t src_size,
+               uint8_t **out, size_t *out_size);
+
+/*
+ * Compress a decompressed OoT ROM. The version is detected from the build
+ * date and selects the DMA table and the files left uncompressed.
+ */
+int yed_compress_rom(const uint8_t *rom, size_t rom_size, const yed_rom_opts_t *opts,
+                     uint8_t **out, size_t *out_size);
+
+/*
+ * Decompress a compressed OoT ROM on up to `threads` workers (0 = one per
+ * CPU). The output ends exactly at the highest vrom end, without padding.
+ */
+int yed_decompress_rom(const uint8_t *rom, size_t rom_size, int threads,
+                       uint8_t **out, size_t *out_size);
+
+/*
+ * Check a compressed OoT ROM: DMA bounds and overlaps, that every file
+ * decodes cleanly and, if source (the uncompressed ROM) is not NULL, that
+ * it matches the source. Runs on up to `threads` workers (0 = one per CPU).
+ */
+int yed_verify_rom(const uint8_t *rom, size_t rom_size,
+                   const uint8_t *source, size_t source_size, int threads);
+
+/*
+ * CRC-32 (IEEE, as zlib computes it) of data[0..size), continuing from
+ * crc: pass 0 to start, or a previous result to extend it.
+ */
+uint32_t yed_crc32(uint32_t crc, const uint8_t *data, size_t size);
+
+/* Recompute the header checksum of rom in place */
+int yed_fix_crc(uint8_t *rom, size_t rom_size);
+
+/* Release a buffer returned by this library */
+void yed_free(void *p);
+
+YED_API_END
+
+#endif /* YAZ0ENCDEC_H */
\ No newline at end of file
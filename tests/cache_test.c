@@ -0,0 +1,74 @@
+/*
+ * Compress a synthetic ROM twice through one blob cache directory. The
+ * second run must take every compressed file from the cache, storing
+ * nothing new, and produce the same image as the first.
+ */
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE  /* mkdtemp */
+#endif
+
+#include "cache.h"
+#include "compress.h"
+#include "test_rom.h"
+
+#include <unistd.h>
+
+/* Compress rom through the cache in dir; returns the image, exits on failure */
+static uint8_t *compress_cached(const uint8_t *rom, const char *dir, int expect_hits,
+                                size_t *out_size) {
+    dma_table_t dma;
+    parse_test_rom(&dma, rom);
+
+    compress_opts_t opts;
+    compress_default_opts(&opts);
+    opts.quiet = 1;
+    opts.cache = cache_open(dir, (uint64_t)64 * 0x100000);
+    if (!opts.cache) die("cannot open the test cache");
+
+    uint8_t *out;
+    if (compress_rom(rom, 0, &dma, &opts, &out, out_size) != YED_OK)
+        die("compression failed");
+
+    int compressed = 0;
+    for (int i = 0; i < dma.num_entries; i++) {
+        const dma_entry_t *e = &dma.entries[i];
+        if (e->deleted || e->dup_of >= 0) continue;
+        int hit = (e->origin == BLOB_CACHE);
+        if (e->compress && hit != expect_hits) {
+            fprintf(stderr, "entry %d: %s\n", i,
+                    expect_hits ? "not taken from the cache" : "unexpected cache hit");
+            exit(1);
+        }
+        if (e->compress) compressed++;
+    }
+    cache_stats_t st;
+    cache_close(opts.cache, &st);
+    if (expect_hits ? (st.hits != compressed || st.stores != 0)
+                    : (st.hits != 0 || st.stores != compressed))
+        die("cache statistics do not match the entries");
+    free_dma_table(&dma);
+    return out;
+}
+
+int main(void) {
+    char dir[] = "/tmp/yaz0cache-XXXXXX";
+    if (!mkdtemp(dir)) die("cannot create a temporary directory");
+
+    uint8_t *rom = make_test_rom();
+
+    size_t size1, size2;
+    uint8_t *first = compress_cached(rom, dir, 0, &size1);
+    uint8_t *second = compress_cached(rom, dir, 1, &size2);
+    int ok = size1 == size2 && memcmp(first, second, size1) == 0;
+
+    /* Empty the cache so the directory can go */
+    cache_close(cache_open(dir, 0), NULL);
+    rmdir(dir);
+    free(first);
+    free(second);
+    free(rom);
+
+    if (!ok) die("cached run produced a different image");
+    printf("cache_test: ok\n");
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,48 @@
+/*
+ * Parallel ROM compression: compress the test ROM on several thread
+ * counts. Every run must produce the same image, DMA table included, as
+ * the single-threaded one.
+ */
+#include "compress.h"
+#include "test_rom.h"
+
+static uint8_t *compress_threads(const uint8_t *rom, int threads, size_t *out_size) {
+    dma_table_t dma;
+    parse_test_rom(&dma, rom);
+    compress_opts_t opts;
+    compress_default_opts(&opts);
+    opts.yaz0.threads = threads;
+    opts.quiet = 1;
+    uint8_t *out;
+    if (compress_rom(rom, 0, &dma, &opts, &out, out_size) != YED_OK)
+        die("compression failed");
+    free_dma_table(&dma);
+    return out;
+}
+
+int main(void) {
+    static const int threads[] = { 2, 3, 8, 0 };
+    int failures = 0;
+    uint8_t *rom = make_test_rom();
+
+    size_t first_size;
+    uint8_t *first = compress_threads(rom, 1, &first_size);
+    for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+        size_t size;
+        uint8_t *out = compress_threads(rom, threads[t], &size);
+        if (size != first_size || memcmp(out, first, size) != 0) {
+            fprintf(stderr, "%d threads give a different image\n", threads[t]);
+            failures++;
+        }
+        free(out);
+    }
+    free(first);
+    free(rom);
+
+    if (failures) {
+        fprintf(stderr, "compress_test: %d failures\n", failures);
+        return 1;
+    }
+    printf("compress_test: ok\n");
+    return 0;
+}
\ No newline at end of file
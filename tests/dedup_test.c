@@ -0,0 +1,70 @@
+/*
+ * Duplicate files: every TEST_ROM_DUP_EVERY-th file of the test ROM
+ * repeats the one before it. Compression must find each such pair. With
+ * share_dups both DMA entries of a pair point at one blob, and the image
+ * must still verify against the source; without it each entry keeps its
+ * own copy of the same bytes.
+ */
+#include "compress.h"
+#include "verify.h"
+#include "test_rom.h"
+
+#define NUM_DUPS  ((TEST_ROM_FILES - 1) / TEST_ROM_DUP_EVERY)
+
+static int failures = 0;
+
+static void check(int share, const uint8_t *rom) {
+    dma_table_t dma;
+    parse_test_rom(&dma, rom);
+    compress_opts_t opts;
+    compress_default_opts(&opts);
+    opts.share_dups = share;
+    opts.quiet = 1;
+    uint8_t *out;
+    size_t out_size;
+    if (compress_rom(rom, 0, &dma, &opts, &out, &out_size) != YED_OK)
+        die("compression failed");
+
+    int dups = 0;
+    for (int i = 0; i < dma.num_entries; i++) {
+        if (dma.entries[i].dup_of < 0) continue;
+        dups++;
+        size_t a = dma.offset + (size_t)i * 16;
+        size_t b = dma.offset + (size_t)dma.entries[i].dup_of * 16;
+        uint32_t pstart = get32(out, a + 8), pend = get32(out, a + 12);
+        uint32_t first_pstart = get32(out, b + 8), first_pend = get32(out, b + 12);
+        uint32_t len = (pend ? pend : pstart + get32(out, a + 4) - get32(out, a)) - pstart;
+        int same_blob = pstart == first_pstart && pend == first_pend;
+        if (share ? !same_blob : (same_blob || memcmp(out + pstart, out + first_pstart, len) != 0)) {
+            fprintf(stderr, "%s: entry %d does not %s entry %d's blob\n",
+                    share ? "shared" : "copied", i, share ? "share" : "copy",
+                    dma.entries[i].dup_of);
+            failures++;
+        }
+    }
+    if (dups != NUM_DUPS) {
+        fprintf(stderr, "%s: %d duplicates found, expected %d\n",
+                share ? "shared" : "copied", dups, NUM_DUPS);
+        failures++;
+    }
+    if (verify_rom(out, out_size, rom, TEST_ROM_SIZE, 0, 1) != YED_OK) {
+        fprintf(stderr, "%s: image does not verify\n", share ? "shared" : "copied");
+        failures++;
+    }
+    free(out);
+    free_dma_table(&dma);
+}
+
+int main(void) {
+    uint8_t *rom = make_test_rom();
+    check(0, rom);
+    check(1, rom);
+    free(rom);
+
+    if (failures) {
+        fprintf(stderr, "dedup_test: %d failures\n", failures);
+        return 1;
+    }
+    printf("dedup_test: ok\n");
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,185 @@
+/*
+ * Golden output: with default settings yaz0_encode must produce exactly
+ * the stream of the original encoder, which scanned the whole window
+ * linearly for every position. That encoder is kept here as the
+ * reference and both are run over every generated corpus, over a few
+ * sizes so the ends of the input and of the window are covered.
+ */
+#include "cli.h"
+#include "util.h"
+#include "yaz0.h"
+#include "corpus.h"
+
+#define CORPUS_SIZE  0x20000
+
+/* --- Reference encoder: the original linear scan --- */
+
+static int ref_find(const uint8_t *data, size_t array_ofs, size_t needle_ofs,
+                    int needle_len, int start_index, int source_length) {
+    int limit = source_length - needle_len + 1;
+    if (limit <= 0) return -1;
+
+    uint8_t needle_first = data[needle_ofs];
+
+    while (start_index < limit) {
+        int index = -1;
+        for (int r = start_index; r < limit; r++) {
+            if (data[array_ofs + r] == needle_first) {
+                index = r;
+                break;
+            }
+        }
+        if (index == -1) return -1;
+
+        int found = 1;
+        for (int i = 0; i < needle_len; i++) {
+            if (data[array_ofs + index + i] != data[needle_ofs + i]) {
+                found = 0;
+                break;
+            }
+        }
+        if (found) return index;
+
+        start_index = index + 1;
+    }
+    return -1;
+}
+
+static void ref_search(const uint8_t *data, int pos, int sz, int cap,
+                       int *out_hitp, int *out_hitl) {
+    int mp = (pos > 0x1000) ? (pos - 0x1000) : 0;
+    int ml = (cap < (sz - pos)) ? cap : (sz - pos);
+    if (ml < 3) {
+        *out_hitp = 0;
+        *out_hitl = 0;
+        return;
+    }
+
+    int hitp = 0;
+    int hitl = 3;
+
+    if (mp < pos) {
+        int hl = ref_find(data, mp, pos, hitl, 0, pos + hitl - mp);
+        while (hl >= 0 && hl < (pos - mp)) {
+            while (hitl < ml && data[pos + hitl] == data[mp + hl + hitl])
+                hitl++;
+            mp += hl;
+            hitp = mp;
+            if (hitl == ml) {
+                *out_hitp = hitp;
+                *out_hitl = hitl;
+                return;
+            }
+            mp += 1;
+            hitl += 1;
+            if (mp >= pos) break;
+            hl = ref_find(data, mp, pos, hitl, 0, pos + hitl - mp);
+        }
+    }
+
+    if (hitl < 4) hitl = 1;
+    *out_hitp = hitp;
+    *out_hitl = hitl - 1;
+}
+
+/* One flag byte before every 8 tokens, as the original serializer wrote */
+typedef struct {
+    uint8_t *out;
+    size_t   len;
+    size_t   flag_at;
+    int      ntokens;
+} ref_stream_t;
+
+static void ref_token(ref_stream_t *s, int literal) {
+    if (s->ntokens++ % 8 == 0) {
+        s->flag_at = s->len;
+        s->out[s->len++] = 0;
+    }
+    if (literal) s->out[s->flag_at] |= (uint8_t)(0x80 >> ((s->ntokens - 1) % 8));
+}
+
+static void ref_match(ref_stream_t *s, int dist, int len) {
+    ref_token(s, 0);
+    int e = dist - 1;
+    if (len < 0x12) {
+        s->out[s->len++] = (uint8_t)((len - 2) << 4 | e >> 8);
+        s->out[s->len++] = (uint8_t)e;
+    } else {
+        s->out[s->len++] = (uint8_t)(e >> 8);
+        s->out[s->len++] = (uint8_t)e;
+        s->out[s->len++] = (uint8_t)(len - 0x12);
+    }
+}
+
+static uint8_t *ref_encode(const uint8_t *data, int sz, size_t *out_size) {
+    ref_stream_t s;
+    s.out = (uint8_t *)malloc(yaz0_compress_bound((size_t)sz));
+    if (!s.out) die("out of memory");
+    memset(s.out, 0, 16);
+    memcpy(s.out, "Yaz0", 4);
+    put32(s.out, 4, (uint32_t)sz);
+    s.len = 16;
+    s.flag_at = 0;
+    s.ntokens = 0;
+
+    int pos = 0;
+    while (pos < sz) {
+        int hitp, hitl;
+        ref_search(data, pos, sz, 0x111, &hitp, &hitl);
+        if (hitl < 3) {
+            ref_token(&s, 1);
+            s.out[s.len++] = data[pos];
+            pos += 1;
+            continue;
+        }
+        int tstp, tstl;
+        ref_search(data, pos + 1, sz, 0x111, &tstp, &tstl);
+        if ((hitl + 1) < tstl) {
+            ref_token(&s, 1);
+            s.out[s.len++] = data[pos];
+            pos += 1;
+            hitl = tstl;
+            hitp = tstp;
+        }
+        ref_match(&s, pos - hitp, hitl);
+        pos += hitl;
+    }
+    *out_size = s.len;
+    return s.out;
+}
+
+int main(void) {
+    static const int sizes[] = { 1, 2, 3, 0x111, 0x1000, 0x1003, CORPUS_SIZE };
+    int failures = 0;
+    uint8_t *data = (uint8_t *)malloc(CORPUS_SIZE);
+    if (!data) die("out of memory");
+
+    for (size_t c = 0; c < num_corpora; c++) {
+        corpus_seed(0x9E3779B97F4A7C15ull + c);
+        corpora[c].gen(data, CORPUS_SIZE);
+        for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+            int sz = sizes[k];
+            size_t want_size, got_size;
+            uint8_t *want = ref_encode(data, sz, &want_size);
+            uint8_t *got = yaz0_encode(data, (size_t)sz, &got_size);
+            if (!got) die("out of memory");
+            if (got_size != want_size || memcmp(got, want, want_size) != 0) {
+                size_t at = 0;
+                while (at < got_size && at < want_size && got[at] == want[at]) at++;
+                fprintf(stderr, "%s, %d bytes: differs at 0x%zX (%zu bytes, expected %zu)\n",
+                        corpora[c].name, sz, at, got_size, want_size);
+                failures++;
+            }
+            free(got);
+            free(want);
+        }
+    }
+    free(data);
+
+    if (failures) {
+        fprintf(stderr, "encode_test: %d failures\n", failures);
+        return 1;
+    }
+    printf("encode_test: ok\n");
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,82 @@
+/*
+ * Split encoding: for each level, encode the mixed corpus in 64 KiB
+ * chunks on several thread counts. Every run must give the same stream,
+ * decode to the input, and come within 1% of the serial encoder's size.
+ * A split size larger than the input must give the serial stream itself.
+ */
+#include "cli.h"
+#include "util.h"
+#include "yaz0.h"
+#include "corpus.h"
+
+#define CORPUS_SIZE  0x100000
+#define SPLIT_SIZE   0x10000
+
+static int failures = 0;
+
+static uint8_t *encode(const uint8_t *data, int level, size_t split_size, int threads,
+                       size_t *out_size) {
+    yaz0_params_t params;
+    yaz0_default_params(&params);
+    params.level = level;
+    params.split_size = split_size;
+    params.threads = threads;
+    uint8_t *out = yaz0_encode_ex(data, CORPUS_SIZE, &params, out_size);
+    if (!out) die("out of memory");
+    return out;
+}
+
+int main(void) {
+    static const int threads[] = { 1, 2, 3, 8, 0 };
+    uint8_t *data = (uint8_t *)malloc(CORPUS_SIZE);
+    uint8_t *dec = (uint8_t *)malloc(CORPUS_SIZE);
+    if (!data || !dec) die("out of memory");
+    corpus_seed(0x9E3779B97F4A7C15ull);
+    corpus_mixed(data, CORPUS_SIZE);
+
+    for (int level = YAZ0_LEVEL_GREEDY; level <= YAZ0_LEVEL_OPTIMAL; level++) {
+        size_t serial_size, whole_size, first_size;
+        uint8_t *serial = encode(data, level, 0, 1, &serial_size);
+        uint8_t *whole = encode(data, level, 2 * CORPUS_SIZE, 0, &whole_size);
+        if (whole_size != serial_size || memcmp(whole, serial, serial_size) != 0) {
+            fprintf(stderr, "level %d: one chunk differs from the serial stream\n", level);
+            failures++;
+        }
+
+        uint8_t *first = encode(data, level, SPLIT_SIZE, threads[0], &first_size);
+        size_t n;
+        if (yaz0_decode_checked(first, first_size, dec, CORPUS_SIZE, &n) != YAZ0_OK ||
+            n != CORPUS_SIZE || memcmp(dec, data, CORPUS_SIZE) != 0) {
+            fprintf(stderr, "level %d: split stream does not decode to the input\n", level);
+            failures++;
+        }
+        if (first_size > serial_size + serial_size / 100) {
+            fprintf(stderr, "level %d: split stream is %zu bytes, serial %zu\n",
+                    level, first_size, serial_size);
+            failures++;
+        }
+
+        for (size_t t = 1; t < sizeof(threads) / sizeof(threads[0]); t++) {
+            size_t size;
+            uint8_t *out = encode(data, level, SPLIT_SIZE, threads[t], &size);
+            if (size != first_size || memcmp(out, first, size) != 0) {
+                fprintf(stderr, "level %d: %d threads give a different stream\n",
+                        level, threads[t]);
+                failures++;
+            }
+            free(out);
+        }
+        free(first);
+        free(whole);
+        free(serial);
+    }
+    free(dec);
+    free(data);
+
+    if (failures) {
+        fprintf(stderr, "split_test: %d failures\n", failures);
+        return 1;
+    }
+    printf("split_test: ok\n");
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,108 @@
+/*
+ * Streaming codecs: push corpora through the stream encoder and decoder
+ * with input and output split at random points, from a few bytes to
+ * whole blocks at a time. The encoder must give the same stream as
+ * yaz0_encode_ex with a 64 KiB split, and the decoder must give back the
+ * input and leave bytes after the end of the stream unconsumed.
+ */
+#include "cli.h"
+#include "util.h"
+#include "yaz0.h"
+#include "corpus.h"
+
+#define DATA_SIZE   (0x48000 + 123)  /* a partial block at the end */
+#define STREAM_PAD  16               /* bytes after the stream, left alone */
+#define MAX_STALLS  16               /* calls in a row that may make no progress */
+
+static int failures = 0;
+
+static size_t chunk(size_t max, size_t left) {
+    size_t n = 1 + corpus_rng() % max;
+    return (n < left) ? n : left;
+}
+
+/* Run the streaming encoder (dec == NULL) or decoder over in[0..in_size) */
+static size_t run(yaz0_stream_encoder_t *enc, yaz0_stream_decoder_t *dec,
+                  const uint8_t *in, size_t in_size, uint8_t *out, size_t out_cap,
+                  size_t max_chunk, size_t *in_used) {
+    size_t in_pos = 0, out_pos = 0;
+    int ret = YAZ0_OK, stalls = 0;
+    while (ret == YAZ0_OK && stalls < MAX_STALLS) {
+        size_t in_len = chunk(max_chunk, in_size - in_pos);
+        size_t out_len = chunk(max_chunk, out_cap - out_pos);
+        ret = enc ? yaz0_stream_encoder_run(enc, in + in_pos, &in_len, out + out_pos, &out_len)
+                  : yaz0_stream_decoder_run(dec, in + in_pos, &in_len, out + out_pos, &out_len);
+        stalls = (in_len == 0 && out_len == 0) ? stalls + 1 : 0;
+        in_pos += in_len;
+        out_pos += out_len;
+    }
+    if (ret != YAZ0_STREAM_END) {
+        fprintf(stderr, "%s stopped at %zu in, %zu out: %s\n", enc ? "encoder" : "decoder",
+                in_pos, out_pos, ret < 0 ? yaz0_strerror(ret) : "no progress");
+        failures++;
+    }
+    *in_used = in_pos;
+    return out_pos;
+}
+
+static void check(const char *name, const uint8_t *data, size_t max_chunk) {
+    yaz0_params_t params;
+    yaz0_default_params(&params);
+    params.split_size = 0x10000;
+    size_t want_size;
+    uint8_t *want = yaz0_encode_ex(data, DATA_SIZE, &params, &want_size);
+    if (!want) die("out of memory");
+
+    size_t cap = yaz0_compress_bound(DATA_SIZE) + STREAM_PAD;
+    uint8_t *comp = (uint8_t *)malloc(cap);
+    uint8_t *dec = (uint8_t *)malloc(DATA_SIZE + 1);
+    if (!comp || !dec) die("out of memory");
+
+    yaz0_stream_encoder_t *se = yaz0_stream_encoder_new(NULL, DATA_SIZE);
+    if (!se) die("out of memory");
+    size_t used;
+    size_t comp_size = run(se, NULL, data, DATA_SIZE, comp, cap - STREAM_PAD, max_chunk, &used);
+    yaz0_stream_encoder_free(se);
+    if (used != DATA_SIZE || comp_size != want_size || memcmp(comp, want, want_size) != 0) {
+        fprintf(stderr, "%s, chunks up to %zu: encoder output differs\n", name, max_chunk);
+        failures++;
+    }
+
+    /* Decode the reference stream followed by bytes that are not Yaz0 */
+    memcpy(comp, want, want_size);
+    memset(comp + want_size, 0xA5, STREAM_PAD);
+    yaz0_stream_decoder_t *sd = yaz0_stream_decoder_new();
+    if (!sd) die("out of memory");
+    size_t n = run(NULL, sd, comp, want_size + STREAM_PAD, dec, DATA_SIZE + 1, max_chunk, &used);
+    yaz0_stream_decoder_free(sd);
+    if (n != DATA_SIZE || memcmp(dec, data, DATA_SIZE) != 0 || used > want_size) {
+        fprintf(stderr, "%s, chunks up to %zu: decoder output differs\n", name, max_chunk);
+        failures++;
+    }
+
+    free(dec);
+    free(comp);
+    free(want);
+}
+
+int main(void) {
+    static const size_t max_chunks[] = { 7, 300, 0x18000 };
+    uint8_t *data = (uint8_t *)malloc(DATA_SIZE);
+    if (!data) die("out of memory");
+
+    for (size_t c = 0; c < num_corpora; c++) {
+        for (size_t k = 0; k < sizeof(max_chunks) / sizeof(max_chunks[0]); k++) {
+            corpus_seed(0x9E3779B97F4A7C15ull + c);
+            corpora[c].gen(data, DATA_SIZE);
+            check(corpora[c].name, data, max_chunks[k]);
+        }
+    }
+    free(data);
+
+    if (failures) {
+        fprintf(stderr, "stream_test: %d failures\n", failures);
+        return 1;
+    }
+    printf("stream_test: ok\n");
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,89 @@
+/*
+ * A synthetic decompressed ROM for the tests. It carries the NTSC 1.0
+ * build date and DMA table, so the ROM database recognises it, and holds
+ * TEST_ROM_FILES files of repeated words with some noise after the
+ * makerom, boot and dmadata entries; the DMA entries after those are
+ * deleted. Every TEST_ROM_DUP_EVERY-th file repeats the one before it.
+ */
+#ifndef TEST_ROM_H
+#define TEST_ROM_H
+
+#include "cli.h"
+#include "util.h"
+#include "dma.h"
+#include "romdb.h"
+#include "yaz0encdec.h"
+
+#define TEST_ROM_SIZE       0x400000
+#define TEST_ROM_FILES      128
+#define TEST_ROM_DUP_EVERY  16
+#define TEST_ROM_FIRST      3      /* DMA index of the first file */
+
+static uint64_t test_rng_state = 0x9E3779B97F4A7C15ull;
+
+static uint32_t test_rng(void) {
+    test_rng_state ^= test_rng_state << 13;
+    test_rng_state ^= test_rng_state >> 7;
+    test_rng_state ^= test_rng_state << 17;
+    return (uint32_t)(test_rng_state >> 16);
+}
+
+/* The ROM of rom_versions[0], NTSC 1.0; the same bytes on every call */
+static uint8_t *make_test_rom(void) {
+    const rom_version_t *ver = &rom_versions[0];
+    uint8_t *rom = (uint8_t *)calloc(TEST_ROM_SIZE, 1);
+    if (!rom) die("out of memory");
+    test_rng_state = 0x9E3779B97F4A7C15ull;
+
+    uint32_t dma_end = ver->dma_offset + (uint32_t)ver->dma_count * 16;
+    uint32_t bounds[TEST_ROM_FIRST][2] = {
+        { 0, 0x1000 }, { 0x1000, ver->dma_offset }, { ver->dma_offset, dma_end }
+    };
+    for (int i = 0; i < ver->dma_count; i++) {
+        size_t eofs = ver->dma_offset + (size_t)i * 16;
+        if (i < TEST_ROM_FIRST) {
+            put32(rom, eofs, bounds[i][0]);
+            put32(rom, eofs + 4, bounds[i][1]);
+            put32(rom, eofs + 8, bounds[i][0]);
+        } else if (i >= TEST_ROM_FIRST + TEST_ROM_FILES) {
+            put32(rom, eofs + 8, DMA_DELETED);
+            put32(rom, eofs + 12, DMA_DELETED);
+        }
+    }
+
+    uint32_t pos = (dma_end + 0xFFF) & ~0xFFFu;
+    uint32_t prev = pos, prev_size = 0;
+    for (int f = 0; f < TEST_ROM_FILES; f++) {
+        uint32_t size;
+        if (f > 0 && f % TEST_ROM_DUP_EVERY == 0) {
+            size = prev_size;
+            memcpy(rom + pos, rom + prev, size);
+        } else {
+            size = 0x1000 + (test_rng() % 0x4000) / 16 * 16;
+            uint32_t word = test_rng();
+            for (uint32_t k = 0; k < size; k++)
+                rom[pos + k] = (test_rng() % 8 == 0) ? (uint8_t)test_rng()
+                                                     : (uint8_t)(word >> (8 * (k & 3)));
+        }
+        size_t eofs = ver->dma_offset + (size_t)(TEST_ROM_FIRST + f) * 16;
+        put32(rom, eofs, pos);
+        put32(rom, eofs + 4, pos + size);
+        put32(rom, eofs + 8, pos);
+        prev = pos;
+        prev_size = size;
+        pos += size;
+    }
+    memcpy(rom + ver->build_offset, ver->build_date, 17);
+    return rom;
+}
+
+/* Parse the test ROM's DMA table and mark it as the ROM database does */
+static void parse_test_rom(dma_table_t *dma, const uint8_t *rom) {
+    const rom_version_t *ver = detect_rom_version(rom, TEST_ROM_SIZE);
+    if (!ver) die("test ROM not recognised");
+    if (parse_dma_table(dma, rom, TEST_ROM_SIZE, ver->dma_offset, ver->dma_count) != YED_OK)
+        die("cannot parse the test DMA table");
+    apply_rom_config(dma, ver);
+}
+
+#endif /* TEST_ROM_H */
\ No newline at end of file
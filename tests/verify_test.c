@@ -0,0 +1,108 @@
+/*
+ * Compress the test ROM and check it with verify_rom: as written it must
+ * pass, with and without the source. Then flip one byte in a compressed
+ * file's blob, and separately point one DMA entry past the end of the
+ * ROM; each must fail, with exactly that entry reported.
+ */
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L  /* dup, fileno */
+#endif
+
+#include "compress.h"
+#include "verify.h"
+#include "test_rom.h"
+
+#include <unistd.h>
+
+static int failures = 0;
+
+/*
+ * verify_rom with its report captured. Returns the result and stores the
+ * entry it reported, or -1 if none or more than one was.
+ */
+static int verify_report(const uint8_t *comp, size_t comp_size,
+                         const uint8_t *source, int *entry) {
+    FILE *log = tmpfile();
+    if (!log) die("cannot create a temporary file");
+    fflush(stderr);
+    int saved = dup(2);
+    if (saved < 0 || dup2(fileno(log), 2) < 0) die("cannot redirect stderr");
+    int err = verify_rom(comp, comp_size, source, source ? TEST_ROM_SIZE : 0, 0, 0);
+    fflush(stderr);
+    dup2(saved, 2);
+    close(saved);
+
+    char line[256];
+    int reported = 0;
+    *entry = -1;
+    rewind(log);
+    while (fgets(line, sizeof(line), log)) {
+        int idx;
+        if (sscanf(line, "error: entry %d:", &idx) == 1) {
+            *entry = idx;
+            reported++;
+        }
+    }
+    fclose(log);
+    if (reported != 1) *entry = -1;
+    return err;
+}
+
+static void expect(const char *what, const uint8_t *comp, size_t comp_size,
+                   const uint8_t *source, int want_err, int want_entry) {
+    int entry;
+    int err = verify_report(comp, comp_size, source, &entry);
+    if (err != want_err || (want_err != YED_OK && entry != want_entry)) {
+        fprintf(stderr, "%s: got %d (entry %d), expected %d (entry %d)\n",
+                what, err, entry, want_err, want_entry);
+        failures++;
+    }
+}
+
+int main(void) {
+    uint8_t *rom = make_test_rom();
+    dma_table_t dma;
+    parse_test_rom(&dma, rom);
+    compress_opts_t opts;
+    compress_default_opts(&opts);
+    opts.quiet = 1;
+    uint8_t *comp;
+    size_t comp_size;
+    if (compress_rom(rom, 0, &dma, &opts, &comp, &comp_size) != YED_OK)
+        die("compression failed");
+
+    /* A compressed file to damage */
+    int victim = -1;
+    for (int i = TEST_ROM_FIRST; i < dma.num_entries && victim < 0; i++)
+        if (!dma.entries[i].deleted && dma.entries[i].pend != 0)
+            victim = i;
+    if (victim < 0) die("no compressed file in the test ROM");
+    const dma_entry_t *v = &dma.entries[victim];
+    size_t eofs = dma.offset + (size_t)victim * 16;
+
+    expect("as written", comp, comp_size, rom, YED_OK, -1);
+    expect("as written, no source", comp, comp_size, NULL, YED_OK, -1);
+
+    uint8_t *bad = (uint8_t *)malloc(comp_size);
+    if (!bad) die("out of memory");
+    memcpy(bad, comp, comp_size);
+    bad[v->pstart + (v->pend - v->pstart) / 2] ^= 0x5A;
+    expect("blob byte", bad, comp_size, rom, YED_ERR_VERIFY, victim);
+
+    memcpy(bad, comp, comp_size);
+    put32(bad, eofs + 12, (uint32_t)comp_size + 0x10);
+    expect("DMA entry", bad, comp_size, rom, YED_ERR_VERIFY, victim);
+    expect("DMA entry, no source", bad, comp_size, NULL, YED_ERR_VERIFY, victim);
+
+    free(bad);
+    free(comp);
+    free_dma_table(&dma);
+    free(rom);
+
+    if (failures) {
+        fprintf(stderr, "verify_test: %d failures\n", failures);
+        return 1;
+    }
+    printf("verify_test: ok\n");
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,147 @@
+/*
+ * Feed yaz0_decode_checked well-formed and malformed streams and check
+ * the result code of each: a round trip, a bad header, an output larger
+ * than the destination, every truncation of a real stream, and matches
+ * reaching before the start or past the end of the output. Distance
+ * errors are tried both in the tail loop and in the fast group loop.
+ * yaz0_decode must return the size for the good stream and 0 for the
+ * others.
+ */
+#include "cli.h"
+#include "util.h"
+#include "yaz0.h"
+
+#define DATA_SIZE  0x3000
+#define BIG_SIZE   0x1000  /* enough output for the fast group loop */
+
+static int failures = 0;
+
+static void expect(const char *what, int got, int want) {
+    if (got != want) {
+        fprintf(stderr, "%s: got %d (%s), expected %d (%s)\n", what,
+                got, yaz0_strerror(got), want, yaz0_strerror(want));
+        failures++;
+    }
+}
+
+/* Decode src[0..src_size) into a buffer of dst_cap bytes */
+static int decode(const uint8_t *src, size_t src_size, size_t dst_cap) {
+    uint8_t *dst = (uint8_t *)malloc(dst_cap ? dst_cap : 1);
+    if (!dst) die("out of memory");
+    size_t n;
+    int err = yaz0_decode_checked(src, src_size, dst, dst_cap, &n);
+    free(dst);
+    return err;
+}
+
+/* A 16-byte header for size bytes of output, then body, then zero padding */
+static size_t make_stream(uint8_t *out, uint32_t size,
+                          const uint8_t *body, size_t body_len, size_t pad) {
+    memcpy(out, "Yaz0", 4);
+    put32(out, 4, size);
+    memset(out + 8, 0, 8);
+    memcpy(out + 16, body, body_len);
+    memset(out + 16 + body_len, 0, pad);
+    return 16 + body_len + pad;
+}
+
+/* Both decoders must refuse src */
+static void expect_bad(const char *what, const uint8_t *src, size_t src_size,
+                       size_t dst_cap, int want) {
+    expect(what, decode(src, src_size, dst_cap), want);
+    uint8_t *dst = (uint8_t *)calloc(dst_cap + 1, 1);
+    if (!dst) die("out of memory");
+    if (dst_cap >= 16 && src_size >= 16 && get32(src, 4) <= dst_cap &&
+        yaz0_decode(src, 0, src_size, dst, 0) != 0) {
+        fprintf(stderr, "%s: yaz0_decode accepted the stream\n", what);
+        failures++;
+    }
+    free(dst);
+}
+
+int main(void) {
+    /* A real stream over text-like data with plenty of matches */
+    uint8_t *data = (uint8_t *)malloc(DATA_SIZE);
+    if (!data) die("out of memory");
+    uint32_t x = 12345;
+    for (int i = 0; i < DATA_SIZE; i++) {
+        x = x * 1103515245u + 12345u;
+        data[i] = (uint8_t)("the quick brown fox "[(x >> 16) % 20]);
+    }
+    size_t comp_size;
+    uint8_t *comp = yaz0_encode(data, DATA_SIZE, &comp_size);
+    if (!comp) die("out of memory");
+    size_t used = yaz0_decodes_to(comp, comp_size, data, DATA_SIZE);
+    if (used == 0) die("encoded stream does not decode to its input");
+
+    uint8_t *dst = (uint8_t *)malloc(DATA_SIZE);
+    if (!dst) die("out of memory");
+    size_t n = 0;
+    expect("round trip", yaz0_decode_checked(comp, comp_size, dst, DATA_SIZE, &n), YAZ0_OK);
+    if (n != DATA_SIZE || memcmp(dst, data, DATA_SIZE) != 0) {
+        fprintf(stderr, "round trip: output differs\n");
+        failures++;
+    }
+    memset(dst, 0, DATA_SIZE);
+    if (yaz0_decode(comp, 0, comp_size, dst, 0) != DATA_SIZE ||
+        memcmp(dst, data, DATA_SIZE) != 0) {
+        fprintf(stderr, "yaz0_decode: round trip failed\n");
+        failures++;
+    }
+
+    /* Header */
+    expect_bad("short header", comp, 15, DATA_SIZE, YAZ0_ERR_HEADER);
+    uint8_t *bad = (uint8_t *)malloc(comp_size);
+    if (!bad) die("out of memory");
+    memcpy(bad, comp, comp_size);
+    bad[3] = '1';
+    expect_bad("bad magic", bad, comp_size, DATA_SIZE, YAZ0_ERR_HEADER);
+    expect("small destination", decode(comp, comp_size, DATA_SIZE - 1), YAZ0_ERR_DST_SIZE);
+
+    /* Every cut of the stream before its last token */
+    for (size_t cut = 16; cut < used; cut++) {
+        int err = decode(comp, cut, DATA_SIZE);
+        if (err != YAZ0_ERR_TRUNCATED) {
+            char what[64];
+            snprintf(what, sizeof(what), "truncated at %zu of %zu", cut, used);
+            expect(what, err, YAZ0_ERR_TRUNCATED);
+            break;
+        }
+    }
+
+    /* Hand-made streams: flag bits, then literals and matches */
+    uint8_t s[BIG_SIZE + 64];
+    size_t len;
+
+    /* A match as the very first token: nothing to copy from */
+    static const uint8_t first_match[] = { 0x00, 0x10, 0x00 };
+    len = make_stream(s, 4, first_match, sizeof(first_match), 0);
+    expect_bad("match before start", s, len, 4, YAZ0_ERR_DISTANCE);
+
+    /* The same in the fast loop: one literal, then distance 2 */
+    static const uint8_t far_match[] = { 0x80, 'A', 0x10, 0x01 };
+    len = make_stream(s, BIG_SIZE, far_match, sizeof(far_match), 48);
+    expect_bad("match before start (fast loop)", s, len, BIG_SIZE, YAZ0_ERR_DISTANCE);
+
+    /* One literal, then a 10-byte match into a 4-byte output */
+    static const uint8_t long_match[] = { 0x80, 'A', 0x80, 0x00 };
+    len = make_stream(s, 4, long_match, sizeof(long_match), 0);
+    expect_bad("match past end", s, len, 4, YAZ0_ERR_OVERRUN);
+
+    /* A three-byte match token cut after two bytes */
+    static const uint8_t cut_match[] = { 0x80, 'A', 0x00, 0x00 };
+    len = make_stream(s, 0x40, cut_match, sizeof(cut_match), 0);
+    expect_bad("truncated long match", s, len, 0x40, YAZ0_ERR_TRUNCATED);
+
+    free(bad);
+    free(dst);
+    free(comp);
+    free(data);
+
+    if (failures) {
+        fprintf(stderr, "yaz0_test: %d failures\n", failures);
+        return 1;
+    }
+    printf("yaz0_test: ok\n");
+    return 0;
+}
\ No newline at end of file